@@ -0,0 +1,282 @@
+/*
+ * bench.h - Static Memory Pool benchmark helpers
+ *
+ * Copyright (c) 2024 Laurent Mailloux-Bourassa
+ *
+ * This file is part of the Static Memory Pool (SMP) library.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+/**
+ * @brief Prevents the compiler from optimizing a value away.
+ */
+#define BENCH_KEEP(value) __asm__ volatile("" : : "r"(value) : "memory")
+
+/**
+ * @brief Gets the monotonic time in nanoseconds.
+ */
+static inline uint64_t bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * @brief Advances a xorshift generator and returns its next value.
+ */
+static inline uint32_t bench_rand(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/**
+ * @brief Gets the thread count to sweep up to, from the first argument or the
+ * number of online processors.
+ */
+static inline int bench_max_threads(int argc, char** argv)
+{
+    long count = argc > 1 ? strtol(argv[1], NULL, 10) : 0;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    if (count <= 0) count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    return count > 0 ? (int) count : 1;
+}
+
+/**
+ * @brief Start of a thread run by bench_run_threads.
+ */
+typedef struct bench_thread
+{
+    pthread_barrier_t* barrier;
+    void* (*routine)(void*);
+    int index;
+} bench_thread_t;
+
+/**
+ * @brief Waits for all the threads of a run to be created, then runs the
+ * routine.
+ */
+static inline void* bench_thread_start(void* arg)
+{
+    bench_thread_t* thread = arg;
+
+    pthread_barrier_wait(thread->barrier);
+
+    return thread->routine((void*) (intptr_t) thread->index);
+}
+
+/**
+ * @brief Runs a routine on a number of threads released together by a
+ * barrier, and returns the elapsed time in nanoseconds from their release.
+ * Each thread receives its index as argument.
+ */
+static inline uint64_t bench_run_threads(int thread_count, void* (*routine)(void*))
+{
+    pthread_t threads[thread_count];
+    bench_thread_t starts[thread_count];
+    pthread_barrier_t barrier;
+
+    // The calling thread waits on the barrier too, so that thread creation
+    // is not timed
+    pthread_barrier_init(&barrier, NULL, thread_count + 1);
+
+    for (int i = 0; i < thread_count; i++)
+    {
+        starts[i] = (bench_thread_t) {&barrier, routine, i};
+        pthread_create(&threads[i], NULL, bench_thread_start, &starts[i]);
+    }
+
+    pthread_barrier_wait(&barrier);
+
+    uint64_t start = bench_now();
+
+    for (int i = 0; i < thread_count; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    uint64_t elapsed = bench_now() - start;
+
+    pthread_barrier_destroy(&barrier);
+
+    return elapsed;
+}
+
+/**
+ * @brief Hardware events counted by bench_counters_t.
+ */
+typedef enum bench_counter
+{
+    BENCH_CACHE_MISSES,
+    BENCH_BRANCH_MISSES,
+    BENCH_DTLB_MISSES,
+    BENCH_COUNTER_COUNT
+} bench_counter_t;
+
+/**
+ * @brief Names of the hardware events, indexed by bench_counter_t.
+ */
+static const char* const bench_counter_names[BENCH_COUNTER_COUNT] = {"cache", "branch", "dTLB"};
+
+/**
+ * @brief Hardware counters of the calling thread, -1 for the events that
+ * could not be opened.
+ */
+typedef struct bench_counters
+{
+    int fds[BENCH_COUNTER_COUNT];
+} bench_counters_t;
+
+/**
+ * @brief Opens the hardware counters of the calling thread when the
+ * BENCH_COUNTERS environment variable is set, through perf_event_open on
+ * Linux. Only user space is counted, so that perf_event_paranoid up to 2
+ * allows it.
+ * @return The number of events opened, 0 when counters are disabled or
+ * unavailable.
+ */
+static inline int bench_counters_open(bench_counters_t* counters)
+{
+    int opened = 0;
+
+    for (int i = 0; i < BENCH_COUNTER_COUNT; i++) counters->fds[i] = -1;
+
+#ifdef __linux__
+    if (!getenv("BENCH_COUNTERS")) return 0;
+
+    const uint32_t types[BENCH_COUNTER_COUNT] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE};
+    const uint64_t configs[BENCH_COUNTER_COUNT] =
+    {
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+        PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+    };
+
+    for (int i = 0; i < BENCH_COUNTER_COUNT; i++)
+    {
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = types[i];
+        attr.config = configs[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        counters->fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+
+        if (counters->fds[i] >= 0) opened++;
+    }
+
+    if (!opened) fprintf(stderr, "Hardware counters unavailable, see perf_event_paranoid\n");
+#endif
+
+    return opened;
+}
+
+/**
+ * @brief Resets and starts the opened counters.
+ */
+static inline void bench_counters_start(bench_counters_t* counters)
+{
+#ifdef __linux__
+    for (int i = 0; i < BENCH_COUNTER_COUNT; i++)
+    {
+        if (counters->fds[i] < 0) continue;
+
+        ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#else
+    (void) counters;
+#endif
+}
+
+/**
+ * @brief Stops the opened counters and reads them.
+ * Events that could not be opened or read are given as UINT64_MAX.
+ */
+static inline void bench_counters_stop(bench_counters_t* counters, uint64_t values[BENCH_COUNTER_COUNT])
+{
+    for (int i = 0; i < BENCH_COUNTER_COUNT; i++)
+    {
+        values[i] = UINT64_MAX;
+
+#ifdef __linux__
+        if (counters->fds[i] < 0) continue;
+
+        ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+        if (read(counters->fds[i], &values[i], sizeof(values[i])) != sizeof(values[i])) values[i] = UINT64_MAX;
+#endif
+    }
+}
+
+/**
+ * @brief Prints the counter values divided by an operation count, or dashes
+ * for the unavailable ones, in columns of a given width.
+ */
+static inline void bench_counters_print(const uint64_t values[BENCH_COUNTER_COUNT], uint64_t operations, int width)
+{
+    for (int i = 0; i < BENCH_COUNTER_COUNT; i++)
+    {
+        if (values[i] == UINT64_MAX) printf(" %*s", width, "-");
+        else printf(" %*.3f", width, (double) values[i] / operations);
+    }
+}
+
+/**
+ * @brief Closes the opened counters.
+ */
+static inline void bench_counters_close(bench_counters_t* counters)
+{
+    for (int i = 0; i < BENCH_COUNTER_COUNT; i++)
+    {
+        if (counters->fds[i] >= 0) close(counters->fds[i]);
+        counters->fds[i] = -1;
+    }
+}
+
+#endif /* BENCH_H */
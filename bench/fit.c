@@ -0,0 +1,154 @@
+/*
+ * fit.c - Fit policy benchmark
+ *
+ * Copyright (c) 2024 Laurent Mailloux-Bourassa
+ *
+ * This file is part of the Static Memory Pool (SMP) library.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compares the fit policies of first-fit pools on synthetic workloads. Each
+ * workload keeps a set of slots, every operation freeing a random occupied
+ * slot or filling a random empty one, in a pool sized so that fragmentation
+ * makes some allocations fail. Reports the time per operation and the share
+ * of failed allocations, and with BENCH_COUNTERS set, the cache, branch and
+ * dTLB misses per operation.
+ *
+ * Build: gcc -O2 -pthread -Isrc bench/fit.c src/smp.c -o fit
+ * Usage: [BENCH_COUNTERS=1] ./fit
+ */
+
+#include "bench.h"
+#include "smp.h"
+
+#define POOL_SIZE (1u << 20)
+#define SLOT_COUNT 4096
+#define OPERATIONS 2000000
+
+SMP_POOL(first_pool, POOL_SIZE, SMP_FIT(SMP_FIT_FIRST))
+SMP_POOL(next_pool, POOL_SIZE, SMP_FIT(SMP_FIT_NEXT))
+SMP_POOL(best_pool, POOL_SIZE, SMP_FIT(SMP_FIT_BEST))
+SMP_POOL(good_pool, POOL_SIZE, SMP_FIT(SMP_FIT_GOOD))
+
+typedef struct workload
+{
+    const char* name;
+    uint32_t (*size)(uint32_t* state);
+} workload_t;
+
+static bench_counters_t counters;
+static int counter_count;
+
+static uint32_t uniform_size(uint32_t* state)
+{
+    return 16 + bench_rand(state) % 1008;
+}
+
+static uint32_t bimodal_size(uint32_t* state)
+{
+    uint32_t value = bench_rand(state);
+
+    return value % 8 ? 16 + value % 48 : 1024 + value % 3072;
+}
+
+static uint32_t power_law_size(uint32_t* state)
+{
+    return 16u << (bench_rand(state) % 64 ? bench_rand(state) % 7 : 8 + bench_rand(state) % 3);
+}
+
+static void run(const workload_t* workload, smp_pool_t* pool, const char* name)
+{
+    static smp_ptr_t slots[SLOT_COUNT];
+    uint32_t state = 2463534242u;
+    uint32_t allocations = 0;
+    uint32_t failures = 0;
+    uint64_t events[BENCH_COUNTER_COUNT];
+
+    bench_counters_start(&counters);
+
+    uint64_t start = bench_now();
+
+    for (uint32_t i = 0; i < OPERATIONS; i++)
+    {
+        uint32_t slot = bench_rand(&state) % SLOT_COUNT;
+
+        if (slots[slot])
+        {
+            smp_dealloc(pool, slots[slot]);
+            slots[slot] = NULL;
+            continue;
+        }
+
+        slots[slot] = smp_alloc(pool, workload->size(&state));
+        allocations++;
+
+        if (!slots[slot]) failures++;
+    }
+
+    uint64_t elapsed = bench_now() - start;
+
+    bench_counters_stop(&counters, events);
+
+    for (uint32_t i = 0; i < SLOT_COUNT; i++)
+    {
+        smp_dealloc(pool, slots[i]);
+        slots[i] = NULL;
+    }
+
+    printf("%-10s %-6s %10.1f %12.2f", workload->name, name, (double) elapsed / OPERATIONS, 100.0 * failures / allocations);
+
+    if (counter_count) bench_counters_print(events, OPERATIONS, 8);
+
+    printf("\n");
+}
+
+int main(void)
+{
+    const workload_t workloads[] =
+    {
+        {"uniform", uniform_size},
+        {"bimodal", bimodal_size},
+        {"power", power_law_size},
+    };
+
+    counter_count = bench_counters_open(&counters);
+
+    printf("%-10s %-6s %10s %12s", "workload", "fit", "ns/op", "failed %");
+
+    for (int i = 0; counter_count && i < BENCH_COUNTER_COUNT; i++)
+    {
+        printf(" %8s", bench_counter_names[i]);
+    }
+
+    printf("\n");
+
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+    {
+        run(&workloads[i], &first_pool, "first");
+        run(&workloads[i], &next_pool, "next");
+        run(&workloads[i], &best_pool, "best");
+        run(&workloads[i], &good_pool, "good");
+    }
+
+    bench_counters_close(&counters);
+
+    return 0;
+}
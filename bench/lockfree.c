@@ -0,0 +1,123 @@
+/*
+ * lockfree.c - Lock-free slab benchmark
+ *
+ * Copyright (c) 2024 Laurent Mailloux-Bourassa
+ *
+ * This file is part of the Static Memory Pool (SMP) library.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compares the throughput of a lock-free slab with slabs protected by a
+ * spinlock, a mutex and a futex, from 1 to N threads (N defaulting to the
+ * number of processors). Each thread repeatedly allocates a few objects and
+ * frees them again.
+ *
+ * Build: gcc -O2 -pthread -Isrc bench/lockfree.c src/smp.c -o lockfree
+ * Usage: ./lockfree [max_threads]
+ */
+
+#include "bench.h"
+#include "smp.h"
+
+#define OBJECT_SIZE 64
+#define OBJECT_COUNT 4096
+#define HELD_COUNT 8
+#define ITERATIONS 200000
+
+SMP_SLAB_LOCKFREE(lockfree_slab, OBJECT_SIZE, OBJECT_COUNT)
+SMP_SLAB(spin_slab, OBJECT_SIZE, OBJECT_COUNT, SMP_LOCK_SPIN)
+SMP_SLAB(mutex_slab, OBJECT_SIZE, OBJECT_COUNT, SMP_LOCK_MUTEX)
+#ifdef __linux__
+SMP_SLAB(futex_slab, OBJECT_SIZE, OBJECT_COUNT, SMP_LOCK_FUTEX)
+#endif
+
+static smp_pool_t* bench_pool;
+
+static void* bench_worker(void* arg)
+{
+    smp_ptr_t held[HELD_COUNT];
+    (void) arg;
+
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        for (int j = 0; j < HELD_COUNT; j++)
+        {
+            held[j] = smp_alloc(bench_pool, OBJECT_SIZE);
+            BENCH_KEEP(held[j]);
+        }
+
+        for (int j = 0; j < HELD_COUNT; j++)
+        {
+            smp_dealloc(bench_pool, held[j]);
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    struct
+    {
+        const char* name;
+        smp_pool_t* pool;
+    } pools[] =
+    {
+        {"lockfree", &lockfree_slab},
+        {"spin", &spin_slab},
+        {"mutex", &mutex_slab},
+#ifdef __linux__
+        {"futex", &futex_slab},
+#endif
+    };
+    int pool_count = sizeof(pools) / sizeof(pools[0]);
+    int max_threads = bench_max_threads(argc, argv);
+
+    if (max_threads * HELD_COUNT > OBJECT_COUNT) max_threads = OBJECT_COUNT / HELD_COUNT;
+
+    printf("%-8s", "threads");
+
+    for (int p = 0; p < pool_count; p++)
+    {
+        printf(" %12s", pools[p].name);
+    }
+
+    printf("   (Mops/s)\n");
+
+    for (int threads = 1; threads <= max_threads; threads++)
+    {
+        printf("%-8d", threads);
+
+        for (int p = 0; p < pool_count; p++)
+        {
+            bench_pool = pools[p].pool;
+
+            uint64_t elapsed = bench_run_threads(threads, bench_worker);
+            double ops = 2.0 * HELD_COUNT * ITERATIONS * threads;
+
+            printf(" %12.2f", ops * 1000.0 / elapsed);
+        }
+
+        printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,345 @@
+/*
+ * malloc.c - Comparison benchmark against the system allocator
+ *
+ * Copyright (c) 2024 Laurent Mailloux-Bourassa
+ *
+ * This file is part of the Static Memory Pool (SMP) library.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Replays the same allocation traces on malloc and on pools of each engine
+ * with block headers. Traces cover fixed-size ping-pong, random sizes, LIFO
+ * and FIFO free orders, calloc, and sizes growing over time, the latter being
+ * reported in four phases to show how fragmentation builds up. Every
+ * operation is timed on its own, the cost of reading the clock being
+ * subtracted, and the mean and percentiles of the latencies are reported
+ * along with the fragmentation of the pools at the end of the trace. With
+ * BENCH_COUNTERS set, the cache, branch and dTLB misses per operation are
+ * also reported, counted over whole replays and so including the clock reads.
+ *
+ * Build: gcc -O2 -pthread -Isrc bench/malloc.c src/smp.c -o malloc
+ * Usage: [BENCH_COUNTERS=1] ./malloc
+ */
+
+#include <string.h>
+#include <stdbool.h>
+#include "bench.h"
+#include "smp.h"
+
+#define POOL_SIZE (16u << 20)
+#define SLOT_COUNT 4096
+#define OPERATIONS 1000000
+#define PHASE_COUNT 4
+
+// Pools only zero memory for calloc, like malloc
+SMP_POOL_WITH_API(first_pool, POOL_SIZE, SMP_ZEROING(SMP_ZERO_ON_CALLOC))
+SMP_POOL_SEGREGATED(segregated_pool, POOL_SIZE, SMP_ZEROING(SMP_ZERO_ON_CALLOC))
+SMP_API(segregated_pool)
+SMP_POOL_TLSF(tlsf_pool, POOL_SIZE, SMP_ZEROING(SMP_ZERO_ON_CALLOC))
+SMP_API(tlsf_pool)
+
+typedef enum operation_kind
+{
+    OPERATION_ALLOC,
+    OPERATION_CALLOC,
+    OPERATION_FREE
+} operation_kind_t;
+
+typedef struct operation
+{
+    uint32_t kind;
+    uint32_t slot;
+    uint32_t size;
+} operation_t;
+
+typedef struct allocator
+{
+    const char* name;
+    smp_pool_t* pool; // NULL for malloc
+    void* (*alloc)(size_t size);
+    void* (*calloc)(size_t nitems, size_t size);
+    void (*dealloc)(void* ptr);
+} allocator_t;
+
+typedef struct workload
+{
+    const char* name;
+    void (*generate)(operation_t* trace);
+    uint32_t phases;
+} workload_t;
+
+static operation_t trace[OPERATIONS];
+static uint32_t latencies[OPERATIONS];
+static void* slots[SLOT_COUNT];
+static uint64_t timer_cost;
+static bench_counters_t counters;
+static int counter_count;
+
+// Traces only free live slots, tracked while they are generated
+static uint8_t live[SLOT_COUNT];
+
+static void set_op(operation_t* op, operation_kind_t kind, uint32_t slot, uint32_t size)
+{
+    op->kind = kind;
+    op->slot = slot;
+    op->size = size;
+    live[slot] = kind != OPERATION_FREE;
+}
+
+static void generate_ping_pong(operation_t* trace)
+{
+    for (uint32_t i = 0; i < OPERATIONS; i += 2)
+    {
+        set_op(&trace[i], OPERATION_ALLOC, 0, 64);
+        set_op(&trace[i + 1], OPERATION_FREE, 0, 0);
+    }
+}
+
+// Fills or frees random slots, keeping about half of them live
+static void generate_random(operation_t* trace)
+{
+    uint32_t state = 2463534242u;
+
+    memset(live, 0, sizeof(live));
+
+    for (uint32_t i = 0; i < OPERATIONS; i++)
+    {
+        uint32_t slot = bench_rand(&state) % SLOT_COUNT;
+
+        set_op(&trace[i], live[slot] ? OPERATION_FREE : OPERATION_ALLOC, slot, 16 + bench_rand(&state) % 1008);
+    }
+}
+
+// Allocates rounds of SLOT_COUNT blocks and frees them in reverse or in order
+static void generate_rounds(operation_t* trace, bool lifo)
+{
+    uint32_t state = 88675123u;
+
+    for (uint32_t i = 0; i < OPERATIONS; i += 2 * SLOT_COUNT)
+    {
+        for (uint32_t j = 0; j < SLOT_COUNT && i + j < OPERATIONS; j++)
+        {
+            set_op(&trace[i + j], OPERATION_ALLOC, j, 16 + bench_rand(&state) % 496);
+        }
+
+        for (uint32_t j = 0; j < SLOT_COUNT && i + SLOT_COUNT + j < OPERATIONS; j++)
+        {
+            set_op(&trace[i + SLOT_COUNT + j], OPERATION_FREE, lifo ? SLOT_COUNT - 1 - j : j, 0);
+        }
+    }
+}
+
+static void generate_lifo(operation_t* trace)
+{
+    generate_rounds(trace, true);
+}
+
+static void generate_fifo(operation_t* trace)
+{
+    generate_rounds(trace, false);
+}
+
+static void generate_calloc(operation_t* trace)
+{
+    uint32_t state = 521288629u;
+
+    memset(live, 0, sizeof(live));
+
+    for (uint32_t i = 0; i < OPERATIONS; i++)
+    {
+        uint32_t slot = bench_rand(&state) % SLOT_COUNT;
+
+        set_op(&trace[i], live[slot] ? OPERATION_FREE : OPERATION_CALLOC, slot, 16 + bench_rand(&state) % 4080);
+    }
+}
+
+// Like the random trace, but every phase doubles the largest size, leaving
+// blocks of the earlier phases scattered between the larger ones
+static void generate_growing(operation_t* trace)
+{
+    uint32_t state = 3141592653u;
+
+    memset(live, 0, sizeof(live));
+
+    for (uint32_t i = 0; i < OPERATIONS; i++)
+    {
+        uint32_t slot = bench_rand(&state) % SLOT_COUNT;
+        uint32_t max_size = 256u << (i / (OPERATIONS / PHASE_COUNT));
+
+        set_op(&trace[i], live[slot] ? OPERATION_FREE : OPERATION_ALLOC, slot, 16 + bench_rand(&state) % max_size);
+    }
+}
+
+static void* malloc_calloc(size_t nitems, size_t size)
+{
+    return calloc(nitems, size);
+}
+
+// Replays part of the trace, timing every operation
+static void replay(const allocator_t* allocator, uint32_t begin, uint32_t end)
+{
+    for (uint32_t i = begin; i < end; i++)
+    {
+        const operation_t* op = &trace[i];
+        uint64_t start = bench_now();
+
+        switch (op->kind)
+        {
+            case OPERATION_ALLOC: slots[op->slot] = allocator->alloc(op->size); break;
+            case OPERATION_CALLOC: slots[op->slot] = allocator->calloc(1, op->size); break;
+            default: allocator->dealloc(slots[op->slot]); slots[op->slot] = NULL; break;
+        }
+
+        uint64_t elapsed = bench_now() - start;
+
+        latencies[i] = elapsed > timer_cost ? elapsed - timer_cost : 0;
+    }
+}
+
+static void release_all(const allocator_t* allocator)
+{
+    for (uint32_t i = 0; i < SLOT_COUNT; i++)
+    {
+        allocator->dealloc(slots[i]);
+        slots[i] = NULL;
+    }
+}
+
+static int compare_latencies(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+
+    return (x > y) - (x < y);
+}
+
+static void report(const char* workload, const allocator_t* allocator, uint32_t* samples, uint32_t count, double fragmentation,
+    const uint64_t events[BENCH_COUNTER_COUNT])
+{
+    uint64_t total = 0;
+
+    for (uint32_t i = 0; i < count; i++) total += samples[i];
+
+    qsort(samples, count, sizeof(uint32_t), compare_latencies);
+
+    printf("%-10s %-11s %8.1f %8u %8u %8u %8u", workload, allocator->name, (double) total / count,
+        samples[count / 2], samples[count * 99ull / 100], samples[count * 999ull / 1000], samples[count - 1]);
+
+    if (allocator->pool) printf(" %7.1f", 100.0 * fragmentation);
+    else printf(" %7s", "-");
+
+    if (counter_count) bench_counters_print(events, count, 8);
+
+    printf("\n");
+}
+
+static void run(const workload_t* workload, const allocator_t* allocator)
+{
+    uint32_t phase_length = OPERATIONS / workload->phases;
+
+    // A first replay faults the memory in
+    replay(allocator, 0, OPERATIONS);
+    release_all(allocator);
+
+    for (uint32_t phase = 0; phase < workload->phases; phase++)
+    {
+        char name[32];
+        uint32_t begin = phase * phase_length;
+        double fragmentation = 0.0;
+        uint64_t events[BENCH_COUNTER_COUNT];
+
+        bench_counters_start(&counters);
+        replay(allocator, begin, begin + phase_length);
+        bench_counters_stop(&counters, events);
+
+        if (allocator->pool)
+        {
+            smp_stats_t stats;
+
+            smp_stats(allocator->pool, &stats);
+            fragmentation = stats.fragmentation;
+        }
+
+        if (workload->phases > 1) snprintf(name, sizeof(name), "%s/%u", workload->name, phase + 1);
+        else snprintf(name, sizeof(name), "%s", workload->name);
+
+        report(name, allocator, &latencies[begin], phase_length, fragmentation, events);
+    }
+
+    release_all(allocator);
+}
+
+int main(void)
+{
+    const workload_t workloads[] =
+    {
+        {"ping-pong", generate_ping_pong, 1},
+        {"random", generate_random, 1},
+        {"lifo", generate_lifo, 1},
+        {"fifo", generate_fifo, 1},
+        {"calloc", generate_calloc, 1},
+        {"growing", generate_growing, PHASE_COUNT},
+    };
+
+    const allocator_t allocators[] =
+    {
+        {"malloc", NULL, malloc, malloc_calloc, free},
+        {"first-fit", &first_pool, first_pool_alloc, first_pool_calloc, first_pool_dealloc},
+        {"segregated", &segregated_pool, segregated_pool_alloc, segregated_pool_calloc, segregated_pool_dealloc},
+        {"tlsf", &tlsf_pool, tlsf_pool_alloc, tlsf_pool_calloc, tlsf_pool_dealloc},
+    };
+
+    // The cheapest clock read is subtracted from every sample
+    timer_cost = UINT64_MAX;
+
+    for (uint32_t i = 0; i < 100000; i++)
+    {
+        uint64_t start = bench_now();
+        uint64_t elapsed = bench_now() - start;
+
+        if (elapsed < timer_cost) timer_cost = elapsed;
+    }
+
+    counter_count = bench_counters_open(&counters);
+
+    printf("%-10s %-11s %8s %8s %8s %8s %8s %7s", "workload", "allocator", "ns/op", "p50", "p99", "p99.9", "max", "frag %");
+
+    for (int i = 0; counter_count && i < BENCH_COUNTER_COUNT; i++)
+    {
+        printf(" %8s", bench_counter_names[i]);
+    }
+
+    printf("\n");
+
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+    {
+        workloads[i].generate(trace);
+
+        for (size_t j = 0; j < sizeof(allocators) / sizeof(allocators[0]); j++)
+        {
+            run(&workloads[i], &allocators[j]);
+        }
+    }
+
+    bench_counters_close(&counters);
+
+    return 0;
+}
@@ -0,0 +1,377 @@
+/*
+ * threads.c - Multi-threaded allocator benchmark
+ *
+ * Copyright (c) 2024 Laurent Mailloux-Bourassa
+ *
+ * This file is part of the Static Memory Pool (SMP) library.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Runs the classic allocator stress patterns from 1 to N threads (N
+ * defaulting to the number of processors) on malloc, on TLSF pools behind a
+ * spinlock and a mutex, and on a spinlocked TLSF pool used through thread
+ * caches:
+ *
+ * - threadtest: every thread allocates a batch of objects and frees them.
+ * - larson: every thread replaces random blocks of a working set, the sets
+ *   being handed over to new threads between rounds, as a server would.
+ * - producer-consumer: every thread allocates blocks that the next thread
+ *   frees, passing them through a ring.
+ * - false-sharing: every thread frees a small object allocated next to those
+ *   of the other threads, then allocates, writes and frees its own.
+ *
+ * Reports the allocations per second of all the threads and of each thread,
+ * in millions.
+ *
+ * Build: gcc -O2 -pthread -Isrc bench/threads.c src/smp.c -o threads
+ * Usage: ./threads [max_threads]
+ */
+
+#include <stdbool.h>
+#include <sched.h>
+#include "bench.h"
+#include "smp.h"
+
+#define POOL_SIZE (64u << 20)
+#define MAX_THREADS 64
+
+#define THREADTEST_BATCH 1000
+#define THREADTEST_ROUNDS 200
+
+#define LARSON_SLOTS 1000
+#define LARSON_ROUNDS 10
+#define LARSON_OPERATIONS 20000
+
+#define RING_SIZE 256
+#define PRODUCER_OPERATIONS 200000
+
+#define SHARING_OBJECT_SIZE 8
+#define SHARING_ROUNDS 20000
+#define SHARING_WRITES 100
+
+// Pools only zero memory for calloc, like malloc
+SMP_POOL_TLSF(spin_pool, POOL_SIZE, SMP_LOCK_SPIN, SMP_ZEROING(SMP_ZERO_ON_CALLOC))
+SMP_API(spin_pool)
+SMP_POOL_TLSF(mutex_pool, POOL_SIZE, SMP_LOCK_MUTEX, SMP_ZEROING(SMP_ZERO_ON_CALLOC))
+SMP_API(mutex_pool)
+SMP_POOL_TLSF(cached_pool, POOL_SIZE, SMP_LOCK_SPIN, SMP_ZEROING(SMP_ZERO_ON_CALLOC))
+SMP_API_CACHED(cached_pool)
+
+typedef struct allocator
+{
+    const char* name;
+    void* (*alloc)(size_t size);
+    void (*dealloc)(void* ptr);
+    void (*flush)(void); // Called before a thread exits, NULL when not needed
+} allocator_t;
+
+typedef struct test
+{
+    const char* name;
+    uint64_t (*run)(int thread_count); // Returns the elapsed nanoseconds
+    uint64_t allocations; // Allocations made by every thread
+} test_t;
+
+// Single-producer single-consumer ring of blocks
+typedef struct ring
+{
+    void* slots[RING_SIZE];
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t tail __attribute__((aligned(64)));
+} __attribute__((aligned(64))) ring_t;
+
+static const allocator_t* bench_allocator;
+static int bench_thread_count;
+static int larson_round;
+static void* larson_sets[MAX_THREADS][LARSON_SLOTS];
+static ring_t rings[MAX_THREADS];
+static void* sharing_objects[MAX_THREADS];
+
+static void thread_exit(void)
+{
+    if (bench_allocator->flush) bench_allocator->flush();
+}
+
+static void* threadtest_worker(void* arg)
+{
+    void* batch[THREADTEST_BATCH];
+    (void) arg;
+
+    for (int round = 0; round < THREADTEST_ROUNDS; round++)
+    {
+        for (int i = 0; i < THREADTEST_BATCH; i++)
+        {
+            batch[i] = bench_allocator->alloc(64);
+            BENCH_KEEP(batch[i]);
+        }
+
+        for (int i = 0; i < THREADTEST_BATCH; i++)
+        {
+            bench_allocator->dealloc(batch[i]);
+        }
+    }
+
+    thread_exit();
+
+    return NULL;
+}
+
+static uint64_t threadtest(int thread_count)
+{
+    return bench_run_threads(thread_count, threadtest_worker);
+}
+
+static void* larson_worker(void* arg)
+{
+    int index = (int) (intptr_t) arg;
+    void** set = larson_sets[(index + larson_round) % bench_thread_count];
+    uint32_t state = 2463534242u + index * 7919 + larson_round;
+
+    for (int i = 0; i < LARSON_OPERATIONS; i++)
+    {
+        uint32_t slot = bench_rand(&state) % LARSON_SLOTS;
+
+        bench_allocator->dealloc(set[slot]);
+        set[slot] = bench_allocator->alloc(16 + bench_rand(&state) % 497);
+    }
+
+    thread_exit();
+
+    return NULL;
+}
+
+static void* larson_fill(void* arg)
+{
+    void** set = larson_sets[(intptr_t) arg];
+    uint32_t state = 88675123u + (uint32_t) (intptr_t) arg;
+
+    for (int i = 0; i < LARSON_SLOTS; i++)
+    {
+        set[i] = bench_allocator->alloc(16 + bench_rand(&state) % 497);
+    }
+
+    thread_exit();
+
+    return NULL;
+}
+
+static void* larson_empty(void* arg)
+{
+    void** set = larson_sets[(intptr_t) arg];
+
+    for (int i = 0; i < LARSON_SLOTS; i++)
+    {
+        bench_allocator->dealloc(set[i]);
+        set[i] = NULL;
+    }
+
+    thread_exit();
+
+    return NULL;
+}
+
+static uint64_t larson(int thread_count)
+{
+    uint64_t elapsed = 0;
+
+    bench_run_threads(thread_count, larson_fill);
+
+    // Every round runs on new threads, each taking over the set of another
+    for (larson_round = 0; larson_round < LARSON_ROUNDS; larson_round++)
+    {
+        elapsed += bench_run_threads(thread_count, larson_worker);
+    }
+
+    bench_run_threads(thread_count, larson_empty);
+
+    return elapsed;
+}
+
+static bool ring_push(ring_t* ring, void* ptr)
+{
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == RING_SIZE) return false;
+
+    ring->slots[tail % RING_SIZE] = ptr;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+static bool ring_pop(ring_t* ring, void** ptr)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+    if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) return false;
+
+    *ptr = ring->slots[head % RING_SIZE];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+// Every thread produces into its own ring and consumes the ring of the
+// previous thread, so that every block is freed by another thread
+static void* producer_worker(void* arg)
+{
+    int index = (int) (intptr_t) arg;
+    ring_t* output = &rings[index];
+    ring_t* input = &rings[(index + bench_thread_count - 1) % bench_thread_count];
+    void* pending = NULL;
+    int produced = 0;
+    int consumed = 0;
+
+    while (produced < PRODUCER_OPERATIONS || consumed < PRODUCER_OPERATIONS)
+    {
+        bool progress = false;
+
+        if (produced < PRODUCER_OPERATIONS)
+        {
+            if (!pending) pending = bench_allocator->alloc(16 + produced % 241);
+
+            if (ring_push(output, pending))
+            {
+                pending = NULL;
+                produced++;
+                progress = true;
+            }
+        }
+
+        void* ptr;
+
+        if (consumed < PRODUCER_OPERATIONS && ring_pop(input, &ptr))
+        {
+            bench_allocator->dealloc(ptr);
+            consumed++;
+            progress = true;
+        }
+
+        // Let the other threads run when there are more threads than processors
+        if (!progress) sched_yield();
+    }
+
+    thread_exit();
+
+    return NULL;
+}
+
+static uint64_t producer_consumer(int thread_count)
+{
+    for (int i = 0; i < thread_count; i++)
+    {
+        rings[i].head = 0;
+        rings[i].tail = 0;
+    }
+
+    return bench_run_threads(thread_count, producer_worker);
+}
+
+static void* sharing_worker(void* arg)
+{
+    int index = (int) (intptr_t) arg;
+
+    // The object given by the main thread may share a cache line with those
+    // of the other threads, and so may the objects allocated in its place
+    bench_allocator->dealloc(sharing_objects[index]);
+
+    for (int round = 0; round < SHARING_ROUNDS; round++)
+    {
+        volatile uint8_t* object = bench_allocator->alloc(SHARING_OBJECT_SIZE);
+
+        for (int i = 0; i < SHARING_WRITES; i++)
+        {
+            object[i % SHARING_OBJECT_SIZE]++;
+        }
+
+        bench_allocator->dealloc((void*) object);
+    }
+
+    thread_exit();
+
+    return NULL;
+}
+
+static uint64_t false_sharing(int thread_count)
+{
+    for (int i = 0; i < thread_count; i++)
+    {
+        sharing_objects[i] = bench_allocator->alloc(SHARING_OBJECT_SIZE);
+    }
+
+    return bench_run_threads(thread_count, sharing_worker);
+}
+
+int main(int argc, char** argv)
+{
+    const allocator_t allocators[] =
+    {
+        {"malloc", malloc, free, NULL},
+        {"tlsf-spin", spin_pool_alloc, spin_pool_dealloc, NULL},
+        {"tlsf-mutex", mutex_pool_alloc, mutex_pool_dealloc, NULL},
+        {"tlsf-cached", cached_pool_alloc, cached_pool_dealloc, cached_pool_flush},
+    };
+    const test_t tests[] =
+    {
+        {"threadtest", threadtest, (uint64_t) THREADTEST_BATCH * THREADTEST_ROUNDS},
+        {"larson", larson, (uint64_t) LARSON_OPERATIONS * LARSON_ROUNDS},
+        {"producer-consumer", producer_consumer, PRODUCER_OPERATIONS},
+        {"false-sharing", false_sharing, SHARING_ROUNDS},
+    };
+    int allocator_count = sizeof(allocators) / sizeof(allocators[0]);
+    int max_threads = bench_max_threads(argc, argv);
+
+    if (max_threads > MAX_THREADS) max_threads = MAX_THREADS;
+
+    for (size_t t = 0; t < sizeof(tests) / sizeof(tests[0]); t++)
+    {
+        printf("%s (M allocations/s total / per thread)\n%-8s", tests[t].name, "threads");
+
+        for (int a = 0; a < allocator_count; a++)
+        {
+            printf(" %18s", allocators[a].name);
+        }
+
+        printf("\n");
+
+        for (int threads = 1; threads <= max_threads; threads++)
+        {
+            printf("%-8d", threads);
+
+            for (int a = 0; a < allocator_count; a++)
+            {
+                bench_allocator = &allocators[a];
+                bench_thread_count = threads;
+
+                uint64_t elapsed = tests[t].run(threads);
+                double rate = (double) tests[t].allocations * threads * 1000.0 / elapsed;
+
+                printf(" %9.2f /%7.2f", rate, rate / threads);
+            }
+
+            printf("\n");
+        }
+
+        printf("\n");
+    }
+
+    return 0;
+}
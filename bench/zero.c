@@ -0,0 +1,118 @@
+/*
+ * zero.c - Zeroing kernel benchmark
+ *
+ * Copyright (c) 2024 Laurent Mailloux-Bourassa
+ *
+ * This file is part of the Static Memory Pool (SMP) library.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compares smp_zero with memset across block sizes. For each size, reports
+ * the zeroing bandwidth and the time then needed to read a hot working set,
+ * which grows when zeroing evicted it from the cache.
+ *
+ * Build: gcc -O2 -pthread -Isrc bench/zero.c src/smp.c -o zero
+ * Usage: ./zero
+ */
+
+#include <string.h>
+#include "bench.h"
+#include "smp.h"
+
+#define MAX_SIZE (64u << 20)
+#define BYTES_PER_SIZE (1u << 30)
+#define HOT_SIZE (128u << 10)
+
+static uint64_t hot_read(const uint64_t* hot)
+{
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < HOT_SIZE / sizeof(uint64_t); i += 8)
+    {
+        sum += hot[i];
+    }
+
+    return sum;
+}
+
+static void measure(void (*zero)(void*, size_t), smp_byte_t* buffer, size_t size, const uint64_t* hot, double* gbps, double* hot_ns)
+{
+    size_t rounds = BYTES_PER_SIZE / size;
+    uint64_t zero_time = 0;
+    uint64_t hot_time = 0;
+
+    for (size_t i = 0; i < rounds; i++)
+    {
+        BENCH_KEEP(hot_read(hot));
+
+        uint64_t start = bench_now();
+        zero(buffer, size);
+        uint64_t middle = bench_now();
+        BENCH_KEEP(hot_read(hot));
+        uint64_t end = bench_now();
+
+        zero_time += middle - start;
+        hot_time += end - middle;
+    }
+
+    *gbps = (double) size * rounds / zero_time;
+    *hot_ns = (double) hot_time / rounds;
+}
+
+static void zero_memset(void* ptr, size_t size)
+{
+    memset(ptr, 0, size);
+    BENCH_KEEP(ptr);
+}
+
+static void zero_smp(void* ptr, size_t size)
+{
+    smp_zero(ptr, size);
+    BENCH_KEEP(ptr);
+}
+
+int main(void)
+{
+    smp_byte_t* buffer = aligned_alloc(64, MAX_SIZE);
+    uint64_t* hot = aligned_alloc(64, HOT_SIZE);
+
+    if (!buffer || !hot) return 1;
+
+    memset(buffer, 1, MAX_SIZE);
+    memset(hot, 1, HOT_SIZE);
+
+    printf("%10s %14s %14s %16s %16s\n", "size", "memset GB/s", "smp GB/s", "memset hot ns", "smp hot ns");
+
+    for (size_t size = 4096; size <= MAX_SIZE; size *= 4)
+    {
+        double memset_gbps, memset_hot, smp_gbps, smp_hot;
+
+        measure(zero_memset, buffer, size, hot, &memset_gbps, &memset_hot);
+        measure(zero_smp, buffer, size, hot, &smp_gbps, &smp_hot);
+
+        printf("%10zu %14.2f %14.2f %16.0f %16.0f\n", size, memset_gbps, smp_gbps, memset_hot, smp_hot);
+    }
+
+    free(buffer);
+    free(hot);
+
+    return 0;
+}
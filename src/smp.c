@@ -24,68 +24,391 @@
  * SOFTWARE.
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <string.h>
 #include <stdbool.h>
 #include "smp.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#if defined(SMP_INSTRUMENT) || defined(SMP_TRACE)
+#include <time.h>
+#endif
+
+#ifdef SMP_TRACE
+#include <stdio.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #define SMP_FORCE_INLINE    inline __attribute__((always_inline))
+#define SMP_SPIN_COUNT      100
+#define SMP_NULL_OFFSET     UINT32_MAX
+#define SMP_GRANULE         sizeof(uint32_t)
+
+#ifdef SMP_INSTRUMENT
+#define SMP_PROBE_START(start)          uint64_t start = _smp_ticks()
+#define SMP_PROBE_END(pool, op, start)  _smp_probe_record(&(pool)->instrument.op##s, (pool)->instrument.op##_ticks, start)
+#define SMP_PROBE_COUNT(pool, counter)  __atomic_fetch_add(&(pool)->instrument.counter, 1, __ATOMIC_RELAXED)
+
+// Records an allocation call, counting it as failed when it allocated nothing
+#define SMP_PROBE_ALLOC(pool, start, succeeded)                             \
+    do                                                                      \
+    {                                                                       \
+        SMP_PROBE_END(pool, alloc, start);                                  \
+        if (!(succeeded)) SMP_PROBE_COUNT(pool, failed_allocs);             \
+    } while (0)
+
+// Searches hold the pool lock, so the count only needs to be read atomically
+#define SMP_PROBE_SCAN(pool)                                                \
+    __atomic_store_n(&(pool)->instrument.nodes_scanned,                     \
+        __atomic_load_n(&(pool)->instrument.nodes_scanned, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED)
+#else
+#define SMP_PROBE_START(start)
+#define SMP_PROBE_END(pool, op, start)  ((void) 0)
+#define SMP_PROBE_COUNT(pool, counter)  ((void) 0)
+#define SMP_PROBE_ALLOC(pool, start, succeeded) ((void) 0)
+#define SMP_PROBE_SCAN(pool)            ((void) 0)
+#endif
 
-static SMP_FORCE_INLINE void _smp_coalesce_blocks(smp_block_t* a, smp_block_t* b);
-static SMP_FORCE_INLINE smp_block_t* _smp_get_block_from_offset(uint32_t offset, smp_block_t* relative_to);
+#ifdef SMP_TRACE
+#define SMP_TRACE_RECORD(pool, op, size, ptr, extra)    _smp_trace_record(pool, op, size, ptr, extra)
+#else
+#define SMP_TRACE_RECORD(pool, op, size, ptr, extra)    ((void) 0)
+#endif
+
+// Structure linking a free block to its neighbours in a free list
+// This structure is inside the payload of every free block
+// Links are relative to the block itself, 0 meaning there is no neighbour
+typedef struct smp_links
+{
+    int32_t next;
+    int32_t prev;
+} smp_links_t;
+
+static SMP_FORCE_INLINE void _smp_lock(smp_pool_t* pool);
+static SMP_FORCE_INLINE void _smp_unlock(smp_pool_t* pool);
+static SMP_FORCE_INLINE bool _smp_has_headers(smp_pool_t* pool);
+static SMP_FORCE_INLINE bool _smp_zeroes_on_free(smp_pool_t* pool);
+static bool _smp_dealloc_zero(smp_pool_t* pool, smp_ptr_t ptr);
+static SMP_FORCE_INLINE void _smp_calloc_clear(smp_pool_t* pool, smp_ptr_t ptr, smp_size_t size);
+static SMP_FORCE_INLINE void _smp_count_used(smp_pool_t* pool, smp_size_t blocks, smp_size_t bytes);
+static SMP_FORCE_INLINE void _smp_count_adjust(smp_pool_t* pool, smp_size_t blocks, smp_size_t bytes);
+static smp_size_t _smp_largest_free(smp_pool_t* pool);
+static smp_size_t _smp_list_largest(smp_block_t* block);
+static bool _smp_walk_step(smp_pool_t* pool, smp_size_t* offset, smp_block_info_t* info);
+static smp_ptr_t _smp_pool_alloc(smp_pool_t* pool, smp_size_t size);
+static smp_ptr_t _smp_engine_alloc(smp_pool_t* pool, smp_size_t size);
+static void _smp_engine_dealloc(smp_pool_t* pool, smp_ptr_t ptr);
+static smp_size_t _smp_engine_size(smp_pool_t* pool, smp_ptr_t ptr);
+static smp_ptr_t _smp_block_alloc(smp_pool_t* pool, smp_size_t size);
+static smp_ptr_t _smp_block_aligned_alloc(smp_pool_t* pool, smp_size_t alignment, smp_size_t size);
+static smp_size_t _smp_block_alloc_batch(smp_pool_t* pool, smp_size_t size, smp_size_t count, smp_ptr_t* ptrs);
+static void _smp_block_dealloc(smp_pool_t* pool, smp_block_t* block);
+static void _smp_block_dealloc_batch(smp_pool_t* pool, smp_ptr_t* ptrs, smp_size_t count);
+static int _smp_compare_ptrs(const void* a, const void* b);
+static bool _smp_block_realloc(smp_pool_t* pool, smp_block_t* block, smp_size_t size);
 static SMP_FORCE_INLINE uint32_t _smp_get_relative_offset(smp_block_t* block, smp_block_t* relative_to);
 static SMP_FORCE_INLINE smp_byte_t* _smp_get_ptr_from_block(smp_block_t* block);
 static SMP_FORCE_INLINE smp_block_t* _smp_get_block_from_ptr(smp_byte_t* ptr);
 static SMP_FORCE_INLINE bool _smp_validate_block(smp_block_t* block);
+static SMP_FORCE_INLINE smp_block_t* _smp_get_next_block(smp_pool_t* pool, smp_block_t* block);
+static SMP_FORCE_INLINE smp_block_t* _smp_get_prev_block(smp_block_t* block);
+static SMP_FORCE_INLINE smp_links_t* _smp_get_links(smp_block_t* block);
+static SMP_FORCE_INLINE smp_block_t* _smp_get_linked_block(smp_block_t* block, int32_t link);
+static SMP_FORCE_INLINE int32_t _smp_get_link(smp_block_t* block, smp_block_t* relative_to);
+static SMP_FORCE_INLINE smp_block_t* _smp_get_block_at(smp_pool_t* pool, uint32_t offset);
+static SMP_FORCE_INLINE uint32_t _smp_get_pool_offset(smp_pool_t* pool, smp_block_t* block);
+static SMP_FORCE_INLINE uint32_t _smp_fls(uint32_t value);
+static SMP_FORCE_INLINE smp_size_t _smp_round_size(smp_size_t size);
+static SMP_FORCE_INLINE smp_block_t* _smp_list_push(smp_block_t* head, smp_block_t* block);
+static SMP_FORCE_INLINE smp_block_t* _smp_list_unlink(smp_block_t* head, smp_block_t* block);
+static void _smp_split_block(smp_pool_t* pool, smp_block_t* block, smp_size_t size);
+static void _smp_index_prepare(smp_pool_t* pool);
+static smp_block_t* _smp_index_find(smp_pool_t* pool, smp_size_t size);
+static void _smp_index_insert(smp_pool_t* pool, smp_block_t* block);
+static void _smp_index_remove(smp_pool_t* pool, smp_block_t* block);
+static smp_block_t* _smp_list_find(smp_pool_t* pool, smp_size_t size);
+static void _smp_list_insert(smp_pool_t* pool, smp_block_t* block);
+static void _smp_list_remove(smp_pool_t* pool, smp_block_t* block);
+static smp_block_t* _smp_bins_find(smp_pool_t* pool, smp_bins_t* bins, smp_size_t size);
+static void _smp_bins_insert(smp_pool_t* pool, smp_bins_t* bins, smp_block_t* block);
+static void _smp_bins_remove(smp_pool_t* pool, smp_bins_t* bins, smp_block_t* block);
+static SMP_FORCE_INLINE void _smp_tlsf_mapping(smp_size_t size, uint32_t* fl, uint32_t* sl);
+static smp_block_t* _smp_tlsf_find(smp_pool_t* pool, smp_tlsf_t* tlsf, smp_size_t size);
+static void _smp_tlsf_insert(smp_pool_t* pool, smp_tlsf_t* tlsf, smp_block_t* block);
+static void _smp_tlsf_remove(smp_pool_t* pool, smp_tlsf_t* tlsf, smp_block_t* block);
+static SMP_FORCE_INLINE bool _smp_test_bit(uint32_t* bits, uint32_t index);
+static SMP_FORCE_INLINE void _smp_set_bit(uint32_t* bits, uint32_t index);
+static SMP_FORCE_INLINE void _smp_clear_bit(uint32_t* bits, uint32_t index);
+static smp_ptr_t _smp_buddy_alloc(smp_pool_t* pool, smp_size_t size);
+static void _smp_buddy_dealloc(smp_pool_t* pool, smp_ptr_t ptr);
+static smp_size_t _smp_buddy_size(smp_pool_t* pool, smp_ptr_t ptr);
+static smp_size_t _smp_buddy_owned_size(smp_pool_t* pool, smp_ptr_t ptr);
+static void _smp_buddy_prepare(smp_pool_t* pool, smp_buddy_t* buddy);
+static uint32_t _smp_buddy_find_node(smp_pool_t* pool, smp_buddy_t* buddy, smp_ptr_t ptr, uint32_t* level);
+static void _smp_buddy_push(smp_pool_t* pool, smp_buddy_t* buddy, uint32_t level, uint32_t offset);
+static void _smp_buddy_unlink(smp_pool_t* pool, smp_buddy_t* buddy, uint32_t level, uint32_t offset);
+static smp_ptr_t _smp_slab_alloc(smp_pool_t* pool, smp_size_t size);
+static void _smp_slab_dealloc(smp_pool_t* pool, smp_ptr_t ptr);
+static smp_size_t _smp_slab_size(smp_pool_t* pool, smp_ptr_t ptr);
+static uint32_t _smp_slab_find_object(smp_pool_t* pool, smp_slab_t* slab, smp_ptr_t ptr);
+static smp_ptr_t _smp_lockfree_alloc(smp_pool_t* pool, smp_size_t size);
+static void _smp_lockfree_dealloc(smp_pool_t* pool, smp_ptr_t ptr);
+static smp_size_t _smp_lockfree_used(smp_slab_t* slab);
+static smp_ptr_t _smp_arena_alloc(smp_pool_t* pool, smp_size_t alignment, smp_size_t size);
+
+static void _smp_zero_scalar(smp_byte_t* ptr, smp_size_t size);
+
+#if defined(SMP_INSTRUMENT) || defined(SMP_TRACE)
+static SMP_FORCE_INLINE uint64_t _smp_ticks(void);
+#endif
+
+#ifdef SMP_INSTRUMENT
+static void _smp_probe_record(uint64_t* count, uint64_t* histogram, uint64_t start);
+#endif
+
+#ifdef SMP_TRACE
+static void _smp_trace_record(smp_pool_t* pool, smp_trace_op_t op, smp_size_t size, smp_ptr_t ptr, uint32_t extra);
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+static void _smp_zero_select(smp_byte_t* ptr, smp_size_t size);
+static void _smp_zero_sse2(smp_byte_t* ptr, smp_size_t size);
+static void _smp_zero_avx2(smp_byte_t* ptr, smp_size_t size);
+
+// Kernel streaming large blocks, selected on first use
+static void (*_smp_zero_stream)(smp_byte_t* ptr, smp_size_t size) = _smp_zero_select;
+#else
+static void (*_smp_zero_stream)(smp_byte_t* ptr, smp_size_t size) = _smp_zero_scalar;
+#endif
+
+static void _smp_spinlock_acquire(void* lock);
+static void _smp_spinlock_release(void* lock);
+static SMP_FORCE_INLINE void _smp_cpu_relax(void);
+
+const smp_lock_ops_t smp_spinlock_ops =
+{
+    .acquire = _smp_spinlock_acquire,
+    .release = _smp_spinlock_release
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+static void _smp_mutex_acquire(void* lock);
+static void _smp_mutex_release(void* lock);
+
+const smp_lock_ops_t smp_mutex_ops =
+{
+    .acquire = _smp_mutex_acquire,
+    .release = _smp_mutex_release
+};
+#endif
+
+#if defined(__linux__)
+static void _smp_futex_acquire(void* lock);
+static void _smp_futex_release(void* lock);
+
+const smp_lock_ops_t smp_futex_ops =
+{
+    .acquire = _smp_futex_acquire,
+    .release = _smp_futex_release
+};
+#endif
 
 smp_ptr_t smp_alloc(smp_pool_t* pool, smp_size_t size)
 {
     if (!pool) return NULL;
     
-    smp_block_t* block = pool->head;
-    smp_block_t* prev = NULL;
+    smp_ptr_t ptr = _smp_pool_alloc(pool, size);
     
-    while (block)
+    SMP_TRACE_RECORD(pool, SMP_TRACE_ALLOC, size, ptr, 0);
+    
+    return ptr;
+}
+
+static smp_ptr_t _smp_pool_alloc(smp_pool_t* pool, smp_size_t size)
+{
+    SMP_PROBE_START(start);
+    
+    _smp_lock(pool);
+    
+    smp_ptr_t ptr = _smp_engine_alloc(pool, size);
+    
+    _smp_unlock(pool);
+    
+    SMP_PROBE_ALLOC(pool, start, ptr);
+    
+    return ptr;
+}
+
+smp_size_t smp_alloc_batch(smp_pool_t* pool, smp_size_t size, smp_size_t count, smp_ptr_t* ptrs)
+{
+    if (!pool || !ptrs) return 0;
+    
+    smp_size_t allocated = 0;
+    
+    SMP_PROBE_START(start);
+    
+    _smp_lock(pool);
+    
+    if (_smp_has_headers(pool))
     {
-        if (block->size < size)
-        {
-            prev = block;
-            block = _smp_get_block_from_offset(block->offset, block);
-            continue;
-        }
+        allocated = _smp_block_alloc_batch(pool, size, count, ptrs);
+    }
+    else
+    {
+        while (allocated < count && (ptrs[allocated] = _smp_engine_alloc(pool, size))) allocated++;
+    }
+    
+    _smp_unlock(pool);
+    
+    // A batch is a single call, failing when it falls short of the count
+    SMP_PROBE_ALLOC(pool, start, allocated == count);
+    
+    for (smp_size_t i = 0; i < allocated; i++) SMP_TRACE_RECORD(pool, SMP_TRACE_ALLOC, size, ptrs[i], 0);
+    
+    return allocated;
+}
+
+smp_ptr_t smp_aligned_alloc(smp_pool_t* pool, smp_size_t alignment, smp_size_t size)
+{
+    if (!pool) return NULL;
+    if (!alignment || (alignment & (alignment - 1))) return NULL;
+    
+    if (pool->engine == SMP_ENGINE_ARENA)
+    {
+        SMP_PROBE_START(start);
         
-        smp_size_t remaining_size = block->size - size;
-        smp_block_t* new = NULL;
+        _smp_lock(pool);
         
-        if (remaining_size > sizeof(smp_block_t))
-        {
-            new = _smp_get_block_from_offset(size + sizeof(smp_block_t), block);
-            new->magic = SMP_MAGIC;
-            new->size = remaining_size - sizeof(smp_block_t);
-            new->free = 1;
-            new->offset = _smp_get_relative_offset(_smp_get_block_from_offset(block->offset, block), new);
-            block->size = size;
-        }
+        smp_ptr_t ptr = _smp_arena_alloc(pool, alignment > SMP_ALIGNMENT ? alignment : SMP_ALIGNMENT, size);
         
-        if (prev)
-        {
-            prev->offset = _smp_get_relative_offset(new, prev);
-        }
-        else if (new)
-        {
-            pool->head = new;
-        }
-        else
+        _smp_unlock(pool);
+        
+        SMP_PROBE_ALLOC(pool, start, ptr);
+        SMP_TRACE_RECORD(pool, SMP_TRACE_ALIGNED_ALLOC, size, ptr, alignment);
+        
+        return ptr;
+    }
+    
+    if (!_smp_has_headers(pool))
+    {
+        // Buddy blocks are aligned to their size, slab objects to their stride
+        smp_ptr_t ptr = smp_alloc(pool, pool->engine == SMP_ENGINE_BUDDY && size < alignment ? alignment : size);
+        
+        if (ptr && ((uintptr_t) ptr & (alignment - 1)))
         {
-            pool->head = _smp_get_block_from_offset(block->offset, block);
+            // smp_alloc counted the call as successful
+            SMP_PROBE_COUNT(pool, failed_allocs);
+            smp_dealloc(pool, ptr);
+            return NULL;
         }
         
-        block->free = 0;
-        block->offset = 0;
+        return ptr;
+    }
+    
+    if (alignment <= SMP_ALIGNMENT) return smp_alloc(pool, size);
+    
+    SMP_PROBE_START(start);
+    
+    _smp_lock(pool);
+    
+    smp_ptr_t ptr = _smp_block_aligned_alloc(pool, alignment, size);
+    
+    _smp_unlock(pool);
+    
+    SMP_PROBE_ALLOC(pool, start, ptr);
+    
+    SMP_TRACE_RECORD(pool, SMP_TRACE_ALIGNED_ALLOC, size, ptr, alignment);
+    
+    return ptr;
+}
+
+smp_ptr_t smp_realloc(smp_pool_t* pool, smp_ptr_t ptr, smp_size_t size)
+{
+    if (!pool) return NULL;
+    if (!ptr) return smp_alloc(pool, size);
+    
+    if (!size)
+    {
+        smp_dealloc(pool, ptr);
+        return NULL;
+    }
+    
+    if (ptr < (smp_ptr_t) pool->memory || ptr >= (smp_ptr_t) (pool->memory + pool->size)) return NULL;
+    
+    if (!_smp_has_headers(pool))
+    {
+        // Blocks without header keep their size, so only growing moves them
+        smp_size_t old_size = smp_size(pool, ptr);
+        
+        if (!old_size) return NULL;
+        if (size <= old_size) return ptr;
+        
+        smp_ptr_t new = smp_alloc(pool, size);
         
-        return _smp_get_ptr_from_block(block);
+        if (!new) return NULL;
+        
+        memcpy(new, ptr, old_size);
+        smp_dealloc(pool, ptr);
+        
+        return new;
     }
     
-    return NULL;
+    smp_block_t* block = _smp_get_block_from_ptr(ptr);
+    
+    if (!_smp_validate_block(block) || block->free) return NULL;
+    
+    SMP_PROBE_START(start);
+    
+    if (size > pool->size)
+    {
+        SMP_PROBE_ALLOC(pool, start, false);
+        return NULL;
+    }
+    
+    smp_size_t old_size = block->size;
+    smp_size_t new_size = _smp_round_size(size);
+    
+    // The tail given back by a shrink belongs to the caller until the lock
+    // is taken, so it is zeroed beforehand like smp_dealloc does
+    if (_smp_zeroes_on_free(pool) && old_size > new_size && old_size - new_size >= sizeof(smp_block_t) + sizeof(smp_links_t))
+    {
+        smp_zero((smp_byte_t*) ptr + new_size, old_size - new_size);
+    }
+    
+    _smp_lock(pool);
+    
+    smp_ptr_t new = _smp_block_realloc(pool, block, size) ? ptr : _smp_block_alloc(pool, size);
+    
+    _smp_unlock(pool);
+    
+    // A moved payload is copied and its old block zeroed outside the lock,
+    // the old block being freed afterwards
+    if (new && new != ptr)
+    {
+        memcpy(new, ptr, old_size);
+        
+        if (_smp_zeroes_on_free(pool)) smp_zero(ptr, old_size);
+        
+        _smp_lock(pool);
+        _smp_block_dealloc(pool, block);
+        _smp_unlock(pool);
+    }
+    
+    SMP_PROBE_ALLOC(pool, start, new);
+    SMP_TRACE_RECORD(pool, SMP_TRACE_REALLOC, size, new, (smp_byte_t*) ptr - pool->memory);
+    
+    return new;
 }
 
 smp_ptr_t smp_calloc(smp_pool_t* pool, smp_size_t nitems, smp_size_t size)
@@ -93,7 +416,13 @@ smp_ptr_t smp_calloc(smp_pool_t* pool, smp_size_t nitems, smp_size_t size)
     if (!pool) return NULL;
     if (nitems && size > (SIZE_MAX / nitems)) return NULL;
     
-    return smp_alloc(pool, nitems * size);
+    smp_ptr_t ptr = _smp_pool_alloc(pool, nitems * size);
+    
+    _smp_calloc_clear(pool, ptr, nitems * size);
+    
+    SMP_TRACE_RECORD(pool, SMP_TRACE_CALLOC, nitems * size, ptr, 0);
+    
+    return ptr;
 }
 
 void smp_dealloc(smp_pool_t* pool, smp_ptr_t ptr)
@@ -101,80 +430,55 @@ void smp_dealloc(smp_pool_t* pool, smp_ptr_t ptr)
     if (!pool || !ptr) return;
     if (ptr < (smp_ptr_t) pool->memory || ptr >= (smp_ptr_t) (pool->memory + pool->size)) return;
     
-    smp_block_t* block = _smp_get_block_from_ptr(ptr);
+    // Zeroing is part of the cost of a deallocation
+    SMP_PROBE_START(start);
     
-    if (!_smp_validate_block(block)) return;
+    if (!_smp_dealloc_zero(pool, ptr)) return;
     
-    block->free = 1;
-    memset(ptr, 0, block->size);
+    _smp_lock(pool);
+    _smp_engine_dealloc(pool, ptr);
+    _smp_unlock(pool);
     
-    if (!pool->head)
-    {
-        pool->head = block;
-        return;
-    }
+    SMP_PROBE_END(pool, dealloc, start);
     
-    if (block < pool->head)
-    {
-        // Check if we can coalesce the current and next block
-        if ((smp_block_t*) ((smp_byte_t*) &block[1] + block->size) == pool->head)
-        {
-            _smp_coalesce_blocks(block, pool->head);
-
-            if (block->size == pool->size - sizeof(smp_block_t))
-            {
-                block->offset = 0;
-            }
-        }
-        else
-        {
-            block->offset = _smp_get_relative_offset(pool->head, block);
-        }
-        
-        pool->head = block;
-        return;
-    }
+    SMP_TRACE_RECORD(pool, SMP_TRACE_DEALLOC, 0, ptr, 0);
+}
 
-    // Find the previous free block and make it point to this block
-    smp_block_t* prev = pool->head;
-    smp_block_t* next = NULL;
+void smp_dealloc_batch(smp_pool_t* pool, smp_ptr_t* ptrs, smp_size_t count)
+{
+    if (!pool || !ptrs) return;
     
-    while (prev->offset)
+    qsort(ptrs, count, sizeof(smp_ptr_t), _smp_compare_ptrs);
+    
+    smp_size_t valid = 0;
+    
+    // Keep the pointers to distinct allocated blocks of the pool, zeroing
+    // them before taking the lock like smp_dealloc
+    for (smp_size_t i = 0; i < count; i++)
     {
-        next = _smp_get_block_from_offset(prev->offset, prev);
+        smp_ptr_t ptr = ptrs[i];
         
-        if (next > block) break;
+        if (ptr < (smp_ptr_t) pool->memory || ptr >= (smp_ptr_t) (pool->memory + pool->size)) continue;
+        if (valid && ptrs[valid - 1] == ptr) continue;
+        if (!_smp_dealloc_zero(pool, ptr)) continue;
         
-        prev = next;
-    }
-    
-    // Check if we can coalesce the previous and current block
-    if ((smp_block_t*) ((smp_byte_t*) &prev[1] + prev->size) == block)
-    {
-        _smp_coalesce_blocks(prev, block);
-        block = prev;
+        ptrs[valid++] = ptr;
     }
     
-    if (!next) return;
+    _smp_lock(pool);
     
-    // Check if we can coalesce the current and next block
-    if ((smp_block_t*) ((smp_byte_t*) &block[1] + block->size) == next)
+    if (_smp_has_headers(pool))
     {
-        _smp_coalesce_blocks(block, next);
-
-        if (block->size == pool->size - sizeof(smp_block_t))
-        {
-            block->offset = 0;
-        }
-        else if (block != prev)
-        {
-            prev->offset = _smp_get_relative_offset(block, prev);
-        }
+        _smp_block_dealloc_batch(pool, ptrs, valid);
     }
     else
     {
-        block->offset = _smp_get_relative_offset(next, block);
+        for (smp_size_t i = 0; i < valid; i++) _smp_engine_dealloc(pool, ptrs[i]);
     }
+    
+    _smp_unlock(pool);
+    
+    for (smp_size_t i = 0; i < valid; i++) SMP_TRACE_RECORD(pool, SMP_TRACE_DEALLOC, 0, ptrs[i], 0);
 }
 
 smp_size_t smp_size(smp_pool_t* pool, smp_ptr_t ptr)
@@ -182,6 +486,17 @@ smp_size_t smp_size(smp_pool_t* pool, smp_ptr_t ptr)
     if (!pool || !ptr) return 0;
     if (ptr < (smp_ptr_t) pool->memory || ptr >= (smp_ptr_t) (pool->memory + pool->size)) return 0;
     
+    if (!_smp_has_headers(pool))
+    {
+        smp_size_t size;
+        
+        _smp_lock(pool);
+        size = _smp_engine_size(pool, ptr);
+        _smp_unlock(pool);
+        
+        return size;
+    }
+    
     smp_block_t* block = _smp_get_block_from_ptr(ptr);
 
     if (!_smp_validate_block(block)) return 0;
@@ -189,37 +504,1818 @@ smp_size_t smp_size(smp_pool_t* pool, smp_ptr_t ptr)
     return block->size;
 }
 
-static SMP_FORCE_INLINE void _smp_coalesce_blocks(smp_block_t* a, smp_block_t* b)
+void smp_arena_reset(smp_pool_t* pool)
 {
-    a->size = a->size + b->size + sizeof(smp_block_t);
-    a->offset = _smp_get_relative_offset(_smp_get_block_from_offset(b->offset, b), a) ?: a->offset;
-    memset(b, 0, sizeof(smp_block_t));  
+    smp_release(pool, 0);
 }
 
-static SMP_FORCE_INLINE smp_block_t* _smp_get_block_from_offset(uint32_t offset, smp_block_t* relative_to)
+smp_mark_t smp_mark(smp_pool_t* pool)
 {
-    return (smp_block_t*) ((smp_byte_t*) relative_to + offset ?: NULL);
+    if (!pool || pool->engine != SMP_ENGINE_ARENA) return 0;
+    
+    _smp_lock(pool);
+    
+    smp_mark_t mark = ((smp_arena_t*) pool->control)->used;
+    
+    _smp_unlock(pool);
+    
+    return mark;
 }
 
-static SMP_FORCE_INLINE uint32_t _smp_get_relative_offset(smp_block_t* block, smp_block_t* relative_to)
+void smp_release(smp_pool_t* pool, smp_mark_t mark)
 {
-    smp_byte_t* a = (smp_byte_t*) block;
-    smp_byte_t* b = (smp_byte_t*) relative_to;
+    if (!pool || pool->engine != SMP_ENGINE_ARENA) return;
+    
+    smp_arena_t* arena = pool->control;
+    
+    _smp_lock(pool);
+    
+    if (mark < arena->used)
+    {
+        if (arena->used > arena->dirty) arena->dirty = arena->used;
+        
+        arena->used = mark;
+    }
+    
+    _smp_unlock(pool);
+    
+    SMP_TRACE_RECORD(pool, SMP_TRACE_RELEASE, 0, pool->memory + mark, 0);
+}
 
-    return a > b ? a - b : 0;
+void smp_zero(smp_ptr_t ptr, smp_size_t size)
+{
+    if (!ptr) return;
+    
+    // Small blocks are likely to be used again soon, so they stay in cache
+    if (size < SMP_ZERO_STREAM_THRESHOLD)
+    {
+        memset(ptr, 0, size);
+        return;
+    }
+    
+    __atomic_load_n(&_smp_zero_stream, __ATOMIC_RELAXED)(ptr, size);
 }
 
-static SMP_FORCE_INLINE smp_byte_t* _smp_get_ptr_from_block(smp_block_t* block)
+smp_size_t smp_walk(smp_pool_t* pool, smp_walk_callback_t callback, void* context)
 {
-    return (smp_byte_t*) block + sizeof(smp_block_t);
+    if (!pool || !callback) return 0;
+    
+    smp_size_t offset = 0;
+    smp_size_t visited = 0;
+    smp_block_info_t info;
+    
+    _smp_lock(pool);
+    
+    while (_smp_walk_step(pool, &offset, &info))
+    {
+        visited++;
+        
+        if (callback(&info, context)) break;
+    }
+    
+    _smp_unlock(pool);
+    
+    return visited;
 }
 
-static SMP_FORCE_INLINE smp_block_t* _smp_get_block_from_ptr(smp_byte_t* ptr)
+void smp_iterator_init(smp_iterator_t* iterator, smp_pool_t* pool)
 {
-    return (smp_block_t*) ((smp_byte_t*) ptr - sizeof(smp_block_t));
+    if (!iterator) return;
+    
+    iterator->pool = pool;
+    iterator->offset = 0;
 }
 
-static SMP_FORCE_INLINE bool _smp_validate_block(smp_block_t* block)
+int smp_iterator_next(smp_iterator_t* iterator, smp_block_info_t* block)
 {
-    return block->magic == SMP_MAGIC;
-}
\ No newline at end of file
+    if (!iterator || !iterator->pool || !block) return 0;
+    
+    return _smp_walk_step(iterator->pool, &iterator->offset, block);
+}
+
+void smp_stats(smp_pool_t* pool, smp_stats_t* stats)
+{
+    if (!pool || !stats) return;
+    
+    _smp_lock(pool);
+    
+    stats->used_blocks = pool->counters.used_blocks;
+    stats->used_bytes = pool->counters.used_bytes;
+    stats->high_water = pool->counters.high_water;
+    
+    // Free block counts are relative to the single free block of a new pool
+    stats->free_blocks = pool->counters.free_blocks + 1;
+    
+    switch (pool->engine)
+    {
+        case SMP_ENGINE_BUDDY:
+            stats->free_bytes = pool->size - stats->used_bytes;
+            break;
+        case SMP_ENGINE_SLAB:
+        case SMP_ENGINE_LOCKFREE:
+        {
+            smp_slab_t* slab = pool->control;
+            
+            // Lock-free slabs keep no shared counters: their usage is read
+            // from the used bitmap, and their high-water mark from the
+            // objects carved so far, since freed objects are reused first
+            if (pool->engine == SMP_ENGINE_LOCKFREE)
+            {
+                stats->used_blocks = _smp_lockfree_used(slab);
+                stats->used_bytes = stats->used_blocks * slab->size;
+                stats->high_water = (smp_size_t) __atomic_load_n(&slab->bump, __ATOMIC_RELAXED) * slab->size;
+            }
+            
+            stats->free_blocks = slab->capacity - stats->used_blocks;
+            stats->free_bytes = stats->free_blocks * slab->size;
+            break;
+        }
+        case SMP_ENGINE_ARENA:
+        {
+            smp_arena_t* arena = pool->control;
+            
+            stats->used_bytes = arena->used;
+            stats->free_bytes = pool->size - arena->used;
+            stats->free_blocks = stats->free_bytes ? 1 : 0;
+            stats->high_water = arena->used > arena->dirty ? arena->used : arena->dirty;
+            break;
+        }
+        default:
+            // Headers and payloads tile the memory after the lead bytes
+            stats->free_bytes = pool->size - SMP_BLOCK_LEAD - stats->used_bytes - (stats->used_blocks + stats->free_blocks) * sizeof(smp_block_t);
+            break;
+    }
+    
+    // The counters and the largest free block are read under the same lock,
+    // so that they describe the same state of the pool
+    stats->largest_free = _smp_largest_free(pool);
+    
+    _smp_unlock(pool);
+    
+    // Slab objects all have the same size, so their free memory never fragments
+    bool slab = pool->engine == SMP_ENGINE_SLAB || pool->engine == SMP_ENGINE_LOCKFREE;
+    
+    stats->fragmentation = stats->free_bytes && !slab ? 1.0 - (double) stats->largest_free / stats->free_bytes : 0.0;
+}
+
+#ifdef SMP_INSTRUMENT
+void smp_instrument(smp_pool_t* pool, smp_instrument_t* instrument)
+{
+    if (!pool || !instrument) return;
+    
+    // Counters are updated atomically outside of the pool lock
+    uint64_t* source = (uint64_t*) &pool->instrument;
+    uint64_t* destination = (uint64_t*) instrument;
+    
+    for (smp_size_t i = 0; i < sizeof(smp_instrument_t) / sizeof(uint64_t); i++)
+    {
+        destination[i] = __atomic_load_n(&source[i], __ATOMIC_RELAXED);
+    }
+}
+
+void smp_instrument_reset(smp_pool_t* pool)
+{
+    if (!pool) return;
+    
+    uint64_t* counters = (uint64_t*) &pool->instrument;
+    
+    for (smp_size_t i = 0; i < sizeof(smp_instrument_t) / sizeof(uint64_t); i++)
+    {
+        __atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+    }
+}
+#endif
+
+#ifdef SMP_TRACE
+int smp_trace_dump(smp_pool_t* pool, const char* path)
+{
+    if (!pool || !pool->trace || !path) return -1;
+    
+    smp_trace_t* trace = pool->trace;
+    uint64_t head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+    smp_trace_header_t header =
+    {
+        .magic = SMP_TRACE_MAGIC,
+        .engine = pool->engine,
+        .pool_size = pool->size,
+        .count = head < trace->capacity ? head : trace->capacity,
+        .dropped = head < trace->capacity ? 0 : head - trace->capacity
+    };
+    
+    FILE* file = fopen(path, "wb");
+    
+    if (!file) return -1;
+    
+    // Once the buffer wrapped around, the oldest event is the next one to be
+    // overwritten
+    uint64_t first = header.dropped % trace->capacity;
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(trace->events + first, sizeof(smp_trace_event_t), header.count - first, file) == header.count - first
+        && fwrite(trace->events, sizeof(smp_trace_event_t), first, file) == first;
+    
+    if (fclose(file) || !written) return -1;
+    
+    return 0;
+}
+
+void smp_trace_clear(smp_pool_t* pool)
+{
+    if (!pool || !pool->trace) return;
+    
+    __atomic_store_n(&pool->trace->head, 0, __ATOMIC_RELEASE);
+}
+#endif
+
+smp_ptr_t smp_tcache_alloc(smp_pool_t* pool, smp_tcache_t* cache, smp_size_t size)
+{
+    if (!pool || !cache) return NULL;
+    if (size > SMP_TCACHE_MAX_SIZE) return smp_alloc(pool, size);
+    
+    uint32_t class = size ? (size - 1) / SMP_TCACHE_GRANULE : 0;
+    smp_ptr_t ptr = cache->heads[class];
+    
+    if (ptr)
+    {
+        memcpy(&cache->heads[class], ptr, sizeof(smp_ptr_t));
+        cache->counts[class]--;
+        
+        // Cached memory is zeroed, except for the links of cached blocks
+        memset(ptr, 0, sizeof(smp_ptr_t));
+        
+        return ptr;
+    }
+    
+    // Refill the class with a batch taken under a single lock
+    _smp_lock(pool);
+    
+    ptr = _smp_engine_alloc(pool, (class + 1) * SMP_TCACHE_GRANULE);
+    
+    // Blocks are traced as they leave the pool, cached ones appearing allocated
+    if (ptr) SMP_TRACE_RECORD(pool, SMP_TRACE_ALLOC, (class + 1) * SMP_TCACHE_GRANULE, ptr, 0);
+    
+    for (uint32_t i = 1; ptr && i < SMP_TCACHE_BATCH; i++)
+    {
+        smp_ptr_t extra = _smp_engine_alloc(pool, (class + 1) * SMP_TCACHE_GRANULE);
+        
+        if (!extra) break;
+        
+        SMP_TRACE_RECORD(pool, SMP_TRACE_ALLOC, (class + 1) * SMP_TCACHE_GRANULE, extra, 0);
+        memcpy(extra, &cache->heads[class], sizeof(smp_ptr_t));
+        cache->heads[class] = extra;
+        cache->counts[class]++;
+    }
+    
+    _smp_unlock(pool);
+    
+    return ptr;
+}
+
+smp_ptr_t smp_tcache_calloc(smp_pool_t* pool, smp_tcache_t* cache, smp_size_t nitems, smp_size_t size)
+{
+    if (!pool || !cache) return NULL;
+    if (nitems && size > (SIZE_MAX / nitems)) return NULL;
+    
+    smp_ptr_t ptr = smp_tcache_alloc(pool, cache, nitems * size);
+    
+    // The zero bit of a block header is only updated under the pool lock, so
+    // it may be stale for a block freed into the cache, which is cleared
+    if (ptr && nitems * size <= SMP_TCACHE_MAX_SIZE && pool->zeroing == SMP_ZERO_ON_CALLOC) smp_zero(ptr, nitems * size);
+    else _smp_calloc_clear(pool, ptr, nitems * size);
+    
+    return ptr;
+}
+
+void smp_tcache_dealloc(smp_pool_t* pool, smp_tcache_t* cache, smp_ptr_t ptr)
+{
+    if (!pool || !cache || !ptr) return;
+    if (ptr < (smp_ptr_t) pool->memory || ptr >= (smp_ptr_t) (pool->memory + pool->size)) return;
+    
+    smp_size_t size;
+    
+    if (_smp_has_headers(pool))
+    {
+        smp_block_t* block = _smp_get_block_from_ptr(ptr);
+        
+        if (!_smp_validate_block(block) || block->free) return;
+        
+        size = block->size;
+    }
+    else if (pool->engine == SMP_ENGINE_BUDDY)
+    {
+        size = _smp_buddy_owned_size(pool, ptr);
+    }
+    else
+    {
+        // Arena allocations do not record their size
+        size = pool->engine == SMP_ENGINE_ARENA ? 0 : ((smp_slab_t*) pool->control)->size;
+    }
+    
+    // Blocks too small to serve the first class or too large go to the pool
+    if (size < SMP_TCACHE_GRANULE || size > SMP_TCACHE_MAX_SIZE)
+    {
+        smp_dealloc(pool, ptr);
+        return;
+    }
+    
+    // A block serves the largest class it can hold
+    uint32_t class = size / SMP_TCACHE_GRANULE - 1;
+    
+    if (_smp_zeroes_on_free(pool)) smp_zero(ptr, size);
+    
+    memcpy(ptr, &cache->heads[class], sizeof(smp_ptr_t));
+    cache->heads[class] = ptr;
+    cache->counts[class]++;
+    
+    if (cache->counts[class] < SMP_TCACHE_DEPTH) return;
+    
+    // Flush a batch back to the pool under a single lock
+    _smp_lock(pool);
+    
+    for (uint32_t i = 0; i < SMP_TCACHE_BATCH; i++)
+    {
+        ptr = cache->heads[class];
+        memcpy(&cache->heads[class], ptr, sizeof(smp_ptr_t));
+        cache->counts[class]--;
+        memset(ptr, 0, sizeof(smp_ptr_t));
+        _smp_engine_dealloc(pool, ptr);
+        SMP_TRACE_RECORD(pool, SMP_TRACE_DEALLOC, 0, ptr, 0);
+    }
+    
+    _smp_unlock(pool);
+}
+
+void smp_tcache_flush(smp_pool_t* pool, smp_tcache_t* cache)
+{
+    if (!pool || !cache) return;
+    
+    _smp_lock(pool);
+    
+    for (uint32_t class = 0; class < SMP_TCACHE_CLASS_COUNT; class++)
+    {
+        while (cache->heads[class])
+        {
+            smp_ptr_t ptr = cache->heads[class];
+            
+            memcpy(&cache->heads[class], ptr, sizeof(smp_ptr_t));
+            memset(ptr, 0, sizeof(smp_ptr_t));
+            _smp_engine_dealloc(pool, ptr);
+            SMP_TRACE_RECORD(pool, SMP_TRACE_DEALLOC, 0, ptr, 0);
+        }
+        
+        cache->counts[class] = 0;
+    }
+    
+    _smp_unlock(pool);
+}
+
+static smp_ptr_t _smp_engine_alloc(smp_pool_t* pool, smp_size_t size)
+{
+    switch (pool->engine)
+    {
+        case SMP_ENGINE_BUDDY: return _smp_buddy_alloc(pool, size);
+        case SMP_ENGINE_SLAB: return _smp_slab_alloc(pool, size);
+        case SMP_ENGINE_LOCKFREE: return _smp_lockfree_alloc(pool, size);
+        case SMP_ENGINE_ARENA: return _smp_arena_alloc(pool, SMP_ALIGNMENT, size);
+        default: return _smp_block_alloc(pool, size);
+    }
+}
+
+static void _smp_engine_dealloc(smp_pool_t* pool, smp_ptr_t ptr)
+{
+    switch (pool->engine)
+    {
+        case SMP_ENGINE_BUDDY: _smp_buddy_dealloc(pool, ptr); break;
+        case SMP_ENGINE_SLAB: _smp_slab_dealloc(pool, ptr); break;
+        case SMP_ENGINE_LOCKFREE: _smp_lockfree_dealloc(pool, ptr); break;
+        case SMP_ENGINE_ARENA: break; // Arena memory is only given back by a reset
+        default: _smp_block_dealloc(pool, _smp_get_block_from_ptr(ptr)); break;
+    }
+}
+
+static smp_size_t _smp_engine_size(smp_pool_t* pool, smp_ptr_t ptr)
+{
+    switch (pool->engine)
+    {
+        case SMP_ENGINE_BUDDY: return _smp_buddy_size(pool, ptr);
+        case SMP_ENGINE_SLAB:
+        case SMP_ENGINE_LOCKFREE: return _smp_slab_size(pool, ptr);
+        default: return 0; // Arena allocations do not record their size
+    }
+}
+
+static SMP_FORCE_INLINE void _smp_lock(smp_pool_t* pool)
+{
+    if (pool->lock.ops) pool->lock.ops->acquire(pool->lock.context);
+}
+
+static SMP_FORCE_INLINE void _smp_unlock(smp_pool_t* pool)
+{
+    if (pool->lock.ops) pool->lock.ops->release(pool->lock.context);
+}
+
+static SMP_FORCE_INLINE bool _smp_has_headers(smp_pool_t* pool)
+{
+    return pool->engine <= SMP_ENGINE_TLSF;
+}
+
+static SMP_FORCE_INLINE bool _smp_zeroes_on_free(smp_pool_t* pool)
+{
+    return pool->zeroing == SMP_ZERO_ON_FREE;
+}
+
+static bool _smp_dealloc_zero(smp_pool_t* pool, smp_ptr_t ptr)
+{
+    // A block with a header belongs to the caller until it is marked free,
+    // so its payload is zeroed before taking the lock
+    if (_smp_has_headers(pool))
+    {
+        smp_block_t* block = _smp_get_block_from_ptr(ptr);
+        
+        if (!_smp_validate_block(block) || block->free) return false;
+        
+        if (_smp_zeroes_on_free(pool)) smp_zero(ptr, block->size);
+        
+        return true;
+    }
+    
+    if (!_smp_zeroes_on_free(pool)) return true;
+    
+    // Blocks without header are zeroed before taking the lock as well, once
+    // found to be allocated; lock-free slabs zero them as they free them
+    if (pool->engine == SMP_ENGINE_BUDDY)
+    {
+        smp_size_t size = _smp_buddy_owned_size(pool, ptr);
+        
+        if (!size) return false;
+        
+        smp_zero(ptr, size);
+    }
+    else if (pool->engine == SMP_ENGINE_SLAB)
+    {
+        smp_slab_t* slab = pool->control;
+        
+        if (_smp_slab_find_object(pool, slab, ptr) == SMP_NULL_OFFSET) return false;
+        
+        smp_zero(ptr, slab->size);
+    }
+    
+    return true;
+}
+
+static SMP_FORCE_INLINE void _smp_calloc_clear(smp_pool_t* pool, smp_ptr_t ptr, smp_size_t size)
+{
+    if (!ptr || pool->zeroing == SMP_ZERO_NEVER) return;
+    
+    // Arena memory is only dirty below the highest point reached before a reset
+    if (pool->engine == SMP_ENGINE_ARENA)
+    {
+        smp_byte_t* dirty = pool->memory + ((smp_arena_t*) pool->control)->dirty;
+        
+        if ((smp_byte_t*) ptr < dirty) memset(ptr, 0, (smp_byte_t*) ptr + size < dirty ? size : (smp_size_t) (dirty - (smp_byte_t*) ptr));
+        
+        return;
+    }
+    
+    if (pool->zeroing != SMP_ZERO_ON_CALLOC) return;
+    
+    // Blocks without header do not track whether they are known to be zero
+    if (_smp_has_headers(pool) && _smp_get_block_from_ptr(ptr)->zero) return;
+    
+    smp_zero(ptr, size);
+}
+
+static SMP_FORCE_INLINE void _smp_count_used(smp_pool_t* pool, smp_size_t blocks, smp_size_t bytes)
+{
+    _smp_count_adjust(pool, blocks, bytes);
+    
+    if (pool->counters.used_bytes > pool->counters.high_water) pool->counters.high_water = pool->counters.used_bytes;
+}
+
+// Adjusts the counters without raising the high-water mark, for the
+// intermediate states of operations whose net effect is counted separately
+static SMP_FORCE_INLINE void _smp_count_adjust(smp_pool_t* pool, smp_size_t blocks, smp_size_t bytes)
+{
+    // Decrements are passed as wrapped negative values
+    pool->counters.used_blocks += blocks;
+    pool->counters.used_bytes += bytes;
+}
+
+static smp_size_t _smp_largest_free(smp_pool_t* pool)
+{
+    switch (pool->engine)
+    {
+        case SMP_ENGINE_SEGREGATED:
+        {
+            smp_bins_t* bins = pool->control;
+            
+            if (!bins->ready) return pool->head->size;
+            if (!bins->bitmap) return 0;
+            
+            // The largest block is in the highest bin
+            return _smp_list_largest(_smp_get_block_at(pool, bins->heads[_smp_fls(bins->bitmap)]));
+        }
+        case SMP_ENGINE_TLSF:
+        {
+            smp_tlsf_t* tlsf = pool->control;
+            
+            if (!tlsf->ready) return pool->head->size;
+            if (!tlsf->fl_bitmap) return 0;
+            
+            uint32_t fl = _smp_fls(tlsf->fl_bitmap);
+            
+            return _smp_list_largest(_smp_get_block_at(pool, tlsf->heads[fl][_smp_fls(tlsf->sl_bitmap[fl])]));
+        }
+        case SMP_ENGINE_BUDDY:
+        {
+            smp_buddy_t* buddy = pool->control;
+            
+            if (!buddy->ready) return pool->size;
+            
+            return buddy->bitmap ? pool->size >> __builtin_ctz(buddy->bitmap) : 0;
+        }
+        case SMP_ENGINE_SLAB:
+            return pool->counters.used_blocks < ((smp_slab_t*) pool->control)->capacity ? ((smp_slab_t*) pool->control)->size : 0;
+        case SMP_ENGINE_LOCKFREE:
+            return _smp_lockfree_used(pool->control) < ((smp_slab_t*) pool->control)->capacity ? ((smp_slab_t*) pool->control)->size : 0;
+        case SMP_ENGINE_ARENA:
+            return pool->size - ((smp_arena_t*) pool->control)->used;
+        default:
+            return _smp_list_largest(pool->head);
+    }
+}
+
+static smp_size_t _smp_list_largest(smp_block_t* block)
+{
+    smp_size_t largest = 0;
+    
+    for (; block; block = _smp_get_linked_block(block, _smp_get_links(block)->next))
+    {
+        if (block->size > largest) largest = block->size;
+    }
+    
+    return largest;
+}
+
+static bool _smp_walk_step(smp_pool_t* pool, smp_size_t* offset, smp_block_info_t* info)
+{
+    if (*offset >= pool->size) return false;
+    
+    switch (pool->engine)
+    {
+        case SMP_ENGINE_BUDDY:
+        {
+            smp_buddy_t* buddy = pool->control;
+            uint32_t level = 0;
+            uint32_t node = 0;
+            
+            // The block holding the offset is the first one that is not split
+            while (buddy->ready && _smp_test_bit(buddy->split, node))
+            {
+                level++;
+                node = 2 * node + 1 + ((*offset >> (buddy->pool_log2 - level)) & 1);
+            }
+            
+            info->ptr = pool->memory + *offset;
+            info->size = pool->size >> level;
+            info->free = !buddy->ready || !_smp_test_bit(buddy->used, node);
+            break;
+        }
+        case SMP_ENGINE_SLAB:
+        case SMP_ENGINE_LOCKFREE:
+        {
+            smp_slab_t* slab = pool->control;
+            uint32_t index = *offset / slab->size;
+            
+            info->ptr = pool->memory + *offset;
+            info->size = slab->size;
+            info->free = !(__atomic_load_n(&slab->used[index / 32], __ATOMIC_RELAXED) & (1u << (index % 32)));
+            break;
+        }
+        case SMP_ENGINE_ARENA:
+        {
+            smp_arena_t* arena = pool->control;
+            
+            // The allocated memory is seen as a single block
+            info->ptr = pool->memory + *offset;
+            info->size = *offset < arena->used ? arena->used : pool->size - *offset;
+            info->free = *offset >= arena->used;
+            break;
+        }
+        default:
+        {
+            if (!*offset) *offset = SMP_BLOCK_LEAD;
+            
+            smp_block_t* block = (smp_block_t*) (pool->memory + *offset);
+            
+            if (*offset + sizeof(smp_block_t) > pool->size || !_smp_validate_block(block)) return false;
+            if (*offset + sizeof(smp_block_t) + block->size > pool->size) return false;
+            
+            info->ptr = _smp_get_ptr_from_block(block);
+            info->size = block->size;
+            info->free = block->free;
+            *offset += sizeof(smp_block_t) + block->size;
+            return true;
+        }
+    }
+    
+    *offset += info->size;
+    
+    return true;
+}
+
+static smp_ptr_t _smp_block_alloc(smp_pool_t* pool, smp_size_t size)
+{
+    _smp_index_prepare(pool);
+    
+    if (size > pool->size) return NULL;
+    
+    size = _smp_round_size(size);
+    
+    smp_block_t* block = _smp_index_find(pool, size);
+    
+    if (!block) return NULL;
+    
+    _smp_index_remove(pool, block);
+    _smp_split_block(pool, block, size);
+    
+    block->free = 0;
+    _smp_count_used(pool, 1, block->size);
+    
+    // Free memory is zeroed, except for the links of free blocks
+    memset(_smp_get_links(block), 0, sizeof(smp_links_t));
+    
+    return _smp_get_ptr_from_block(block);
+}
+
+static smp_ptr_t _smp_block_aligned_alloc(smp_pool_t* pool, smp_size_t alignment, smp_size_t size)
+{
+    _smp_index_prepare(pool);
+    
+    if (size > pool->size || alignment > pool->size) return NULL;
+    
+    size = _smp_round_size(size);
+    
+    // Any block this large holds the request after some padding, a padding
+    // being either empty or large enough to become a free block itself
+    smp_block_t* block = _smp_index_find(pool, _smp_round_size(size + alignment + sizeof(smp_block_t) + sizeof(smp_links_t)));
+    
+    if (!block) return NULL;
+    
+    _smp_index_remove(pool, block);
+    
+    smp_byte_t* ptr = _smp_get_ptr_from_block(block);
+    smp_byte_t* aligned = (smp_byte_t*) (((uintptr_t) ptr + alignment - 1) & ~(uintptr_t) (alignment - 1));
+    
+    while (aligned != ptr && aligned < ptr + sizeof(smp_block_t) + sizeof(smp_links_t)) aligned += alignment;
+    
+    // Split the padding off as a free block, which cannot have a free
+    // neighbour since the block it comes from had none
+    if (aligned != ptr)
+    {
+        smp_block_t* new = _smp_get_block_from_ptr(aligned);
+        new->magic = SMP_MAGIC;
+        new->size = block->size - (aligned - ptr);
+        new->free = 1;
+        new->zero = block->zero;
+        new->offset = _smp_get_relative_offset(new, block);
+        block->size = (smp_byte_t*) new - ptr;
+        
+        smp_block_t* next = _smp_get_next_block(pool, new);
+        
+        if (next) next->offset = _smp_get_relative_offset(next, new);
+        
+        _smp_index_insert(pool, block);
+        block = new;
+    }
+    
+    _smp_split_block(pool, block, size);
+    
+    block->free = 0;
+    _smp_count_used(pool, 1, block->size);
+    
+    // Free memory is zeroed, except for the links of free blocks
+    memset(_smp_get_links(block), 0, sizeof(smp_links_t));
+    
+    return _smp_get_ptr_from_block(block);
+}
+
+static smp_size_t _smp_block_alloc_batch(smp_pool_t* pool, smp_size_t size, smp_size_t count, smp_ptr_t* ptrs)
+{
+    _smp_index_prepare(pool);
+    
+    if (size > pool->size) return 0;
+    
+    size = _smp_round_size(size);
+    
+    smp_size_t stride = size + sizeof(smp_block_t);
+    smp_size_t allocated = 0;
+    
+    while (allocated < count)
+    {
+        // Prefer a block holding the whole rest of the batch, otherwise carve
+        // as many blocks as possible out of any block large enough
+        smp_size_t remaining = count - allocated;
+        smp_block_t* block = remaining <= pool->size / stride ? _smp_index_find(pool, remaining * stride - sizeof(smp_block_t)) : NULL;
+        
+        if (!block) block = _smp_index_find(pool, size);
+        if (!block) break;
+        
+        _smp_index_remove(pool, block);
+        
+        smp_size_t carved = (block->size + sizeof(smp_block_t)) / stride;
+        
+        if (carved > remaining) carved = remaining;
+        
+        // Free memory is zeroed, except for the links of free blocks
+        memset(_smp_get_links(block), 0, sizeof(smp_links_t));
+        
+        // Consecutive blocks are laid out at once, the last one keeping
+        // whatever is left for the split
+        for (smp_size_t i = 1; i < carved; i++)
+        {
+            smp_block_t* new = (smp_block_t*) (_smp_get_ptr_from_block(block) + size);
+            new->magic = SMP_MAGIC;
+            new->size = block->size - stride;
+            new->zero = block->zero;
+            new->offset = stride;
+            block->size = size;
+            block->free = 0;
+            _smp_count_used(pool, 1, size);
+            ptrs[allocated++] = _smp_get_ptr_from_block(block);
+            block = new;
+        }
+        
+        smp_block_t* next = _smp_get_next_block(pool, block);
+        
+        if (next) next->offset = _smp_get_relative_offset(next, block);
+        
+        _smp_split_block(pool, block, size);
+        block->free = 0;
+        _smp_count_used(pool, 1, block->size);
+        ptrs[allocated++] = _smp_get_ptr_from_block(block);
+    }
+    
+    return allocated;
+}
+
+static void _smp_block_dealloc(smp_pool_t* pool, smp_block_t* block)
+{
+    _smp_index_prepare(pool);
+    
+    _smp_count_used(pool, -1, -(smp_size_t) block->size);
+    
+    block->free = 1;
+    block->zero = _smp_zeroes_on_free(pool);
+    
+    // Neighbours are found through the block size and the boundary tag,
+    // so coalescing does not depend on the number of free blocks
+    smp_block_t* next = _smp_get_next_block(pool, block);
+    
+    // Check if we can coalesce the current and next block
+    if (next && next->free)
+    {
+        _smp_index_remove(pool, next);
+        block->size = block->size + next->size + sizeof(smp_block_t);
+        block->zero = block->zero && next->zero;
+        memset(next, 0, sizeof(smp_block_t) + sizeof(smp_links_t));
+    }
+    
+    smp_block_t* prev = _smp_get_prev_block(block);
+    
+    // Check if we can coalesce the previous and current block
+    if (prev && prev->free)
+    {
+        _smp_index_remove(pool, prev);
+        prev->size = prev->size + block->size + sizeof(smp_block_t);
+        prev->zero = prev->zero && block->zero;
+        memset(block, 0, sizeof(smp_block_t));
+        block = prev;
+    }
+    
+    next = _smp_get_next_block(pool, block);
+    
+    if (next) next->offset = _smp_get_relative_offset(next, block);
+    
+    _smp_index_insert(pool, block);
+}
+
+static void _smp_block_dealloc_batch(smp_pool_t* pool, smp_ptr_t* ptrs, smp_size_t count)
+{
+    for (smp_size_t i = 0; i < count;)
+    {
+        smp_block_t* block = _smp_get_block_from_ptr(ptrs[i++]);
+        
+        // Merge the run of physically consecutive blocks following this one
+        // before coalescing the run with its free neighbours at once
+        while (i < count && _smp_get_next_block(pool, block) == _smp_get_block_from_ptr(ptrs[i]))
+        {
+            smp_block_t* next = _smp_get_block_from_ptr(ptrs[i++]);
+            
+            block->size = block->size + next->size + sizeof(smp_block_t);
+            _smp_count_adjust(pool, -1, sizeof(smp_block_t));
+            memset(next, 0, sizeof(smp_block_t));
+        }
+        
+        _smp_block_dealloc(pool, block);
+    }
+}
+
+static int _smp_compare_ptrs(const void* a, const void* b)
+{
+    uintptr_t x = (uintptr_t) *(const smp_ptr_t*) a;
+    uintptr_t y = (uintptr_t) *(const smp_ptr_t*) b;
+    
+    return (x > y) - (x < y);
+}
+
+static bool _smp_block_realloc(smp_pool_t* pool, smp_block_t* block, smp_size_t size)
+{
+    _smp_index_prepare(pool);
+    
+    size = _smp_round_size(size);
+    
+    smp_byte_t* ptr = _smp_get_ptr_from_block(block);
+    smp_block_t* next = _smp_get_next_block(pool, block);
+    smp_size_t old_size = block->size;
+    
+    // Grow in place by absorbing the next block when it is free and large
+    // enough, the block having to move otherwise
+    if (size > block->size)
+    {
+        if (!next || !next->free || block->size + sizeof(smp_block_t) + next->size < size) return false;
+        
+        _smp_index_remove(pool, next);
+        block->size = block->size + next->size + sizeof(smp_block_t);
+        memset(next, 0, sizeof(smp_block_t) + sizeof(smp_links_t));
+        
+        next = _smp_get_next_block(pool, block);
+        
+        if (next) next->offset = _smp_get_relative_offset(next, block);
+    }
+    
+    // Give the tail back as a free block, merged with the next block if free
+    // The tail of a shrink was zeroed before the lock was taken, and the one
+    // of an absorbed block is free memory, zero in zeroing pools
+    if (block->size - size >= sizeof(smp_block_t) + sizeof(smp_links_t))
+    {
+        smp_block_t* tail = (smp_block_t*) (ptr + size);
+        
+        tail->magic = SMP_MAGIC;
+        tail->size = block->size - size - sizeof(smp_block_t);
+        tail->offset = _smp_get_relative_offset(tail, block);
+        block->size = size;
+        
+        // The tail is accounted as a used block until it is deallocated
+        _smp_count_adjust(pool, 1, tail->size);
+        _smp_block_dealloc(pool, tail);
+    }
+    
+    // Only the final size counts towards the high-water mark
+    _smp_count_used(pool, 0, block->size - old_size);
+    
+    return true;
+}
+
+static SMP_FORCE_INLINE uint32_t _smp_get_relative_offset(smp_block_t* block, smp_block_t* relative_to)
+{
+    smp_byte_t* a = (smp_byte_t*) block;
+    smp_byte_t* b = (smp_byte_t*) relative_to;
+
+    return a > b ? a - b : 0;
+}
+
+static SMP_FORCE_INLINE smp_byte_t* _smp_get_ptr_from_block(smp_block_t* block)
+{
+    return (smp_byte_t*) block + sizeof(smp_block_t);
+}
+
+static SMP_FORCE_INLINE smp_block_t* _smp_get_block_from_ptr(smp_byte_t* ptr)
+{
+    return (smp_block_t*) ((smp_byte_t*) ptr - sizeof(smp_block_t));
+}
+
+static SMP_FORCE_INLINE bool _smp_validate_block(smp_block_t* block)
+{
+    return block->magic == SMP_MAGIC;
+}
+
+static SMP_FORCE_INLINE smp_block_t* _smp_get_next_block(smp_pool_t* pool, smp_block_t* block)
+{
+    smp_block_t* next = (smp_block_t*) (_smp_get_ptr_from_block(block) + block->size);
+    
+    return (smp_byte_t*) next < pool->memory + pool->size ? next : NULL;
+}
+
+static SMP_FORCE_INLINE smp_block_t* _smp_get_prev_block(smp_block_t* block)
+{
+    return block->offset ? (smp_block_t*) ((smp_byte_t*) block - block->offset) : NULL;
+}
+
+static SMP_FORCE_INLINE smp_links_t* _smp_get_links(smp_block_t* block)
+{
+    return (smp_links_t*) _smp_get_ptr_from_block(block);
+}
+
+static SMP_FORCE_INLINE smp_block_t* _smp_get_linked_block(smp_block_t* block, int32_t link)
+{
+    return link ? (smp_block_t*) ((smp_byte_t*) block + link) : NULL;
+}
+
+static SMP_FORCE_INLINE int32_t _smp_get_link(smp_block_t* block, smp_block_t* relative_to)
+{
+    return block ? (int32_t) ((smp_byte_t*) block - (smp_byte_t*) relative_to) : 0;
+}
+
+static SMP_FORCE_INLINE smp_block_t* _smp_get_block_at(smp_pool_t* pool, uint32_t offset)
+{
+    return offset != SMP_NULL_OFFSET ? (smp_block_t*) (pool->memory + offset) : NULL;
+}
+
+static SMP_FORCE_INLINE uint32_t _smp_get_pool_offset(smp_pool_t* pool, smp_block_t* block)
+{
+    return block ? (uint32_t) ((smp_byte_t*) block - pool->memory) : SMP_NULL_OFFSET;
+}
+
+static SMP_FORCE_INLINE uint32_t _smp_fls(uint32_t value)
+{
+    return 31 - __builtin_clz(value);
+}
+
+static SMP_FORCE_INLINE smp_size_t _smp_round_size(smp_size_t size)
+{
+    // Round up so that free blocks can hold their links and the payload of
+    // the next block stays aligned
+    if (size < sizeof(smp_links_t)) size = sizeof(smp_links_t);
+    
+    return ((size + sizeof(smp_block_t) + SMP_ALIGNMENT - 1) & ~(SMP_ALIGNMENT - 1)) - sizeof(smp_block_t);
+}
+
+static SMP_FORCE_INLINE smp_block_t* _smp_list_push(smp_block_t* head, smp_block_t* block)
+{
+    smp_links_t* links = _smp_get_links(block);
+    
+    links->prev = 0;
+    links->next = _smp_get_link(head, block);
+    
+    if (head) _smp_get_links(head)->prev = _smp_get_link(block, head);
+    
+    return block;
+}
+
+static SMP_FORCE_INLINE smp_block_t* _smp_list_unlink(smp_block_t* head, smp_block_t* block)
+{
+    smp_links_t* links = _smp_get_links(block);
+    smp_block_t* next = _smp_get_linked_block(block, links->next);
+    smp_block_t* prev = _smp_get_linked_block(block, links->prev);
+    
+    if (prev) _smp_get_links(prev)->next = _smp_get_link(next, prev);
+    if (next) _smp_get_links(next)->prev = _smp_get_link(prev, next);
+    
+    return block == head ? next : head;
+}
+
+static void _smp_split_block(smp_pool_t* pool, smp_block_t* block, smp_size_t size)
+{
+    smp_size_t remaining_size = block->size - size;
+    
+    if (remaining_size < sizeof(smp_block_t) + sizeof(smp_links_t)) return;
+    
+    smp_block_t* new = (smp_block_t*) (_smp_get_ptr_from_block(block) + size);
+    new->magic = SMP_MAGIC;
+    new->size = remaining_size - sizeof(smp_block_t);
+    new->free = 1;
+    new->zero = block->zero;
+    new->offset = _smp_get_relative_offset(new, block);
+    block->size = size;
+    
+    smp_block_t* next = _smp_get_next_block(pool, new);
+    
+    if (next) next->offset = _smp_get_relative_offset(next, new);
+    
+    _smp_index_insert(pool, new);
+}
+
+static void _smp_index_prepare(smp_pool_t* pool)
+{
+    uint32_t* ready = NULL;
+    
+    switch (pool->engine)
+    {
+        case SMP_ENGINE_SEGREGATED:
+        {
+            smp_bins_t* bins = pool->control;
+            
+            if (bins->ready) return;
+            
+            ready = &bins->ready;
+            bins->bitmap = 0;
+            memset(bins->heads, 0xFF, sizeof(bins->heads));
+            break;
+        }
+        case SMP_ENGINE_TLSF:
+        {
+            smp_tlsf_t* tlsf = pool->control;
+            
+            if (tlsf->ready) return;
+            
+            ready = &tlsf->ready;
+            tlsf->fl_bitmap = 0;
+            memset(tlsf->sl_bitmap, 0, sizeof(tlsf->sl_bitmap));
+            memset(tlsf->heads, 0xFF, sizeof(tlsf->heads));
+            break;
+        }
+        default:
+            return;
+    }
+    
+    // The pool starts as a single free block
+    *ready = 1;
+    _smp_index_insert(pool, pool->head);
+    pool->head = NULL;
+    
+    // The initial block is counted from the start
+    pool->counters.free_blocks--;
+}
+
+static smp_block_t* _smp_index_find(smp_pool_t* pool, smp_size_t size)
+{
+    switch (pool->engine)
+    {
+        case SMP_ENGINE_SEGREGATED: return _smp_bins_find(pool, pool->control, size);
+        case SMP_ENGINE_TLSF: return _smp_tlsf_find(pool, pool->control, size);
+        default: return _smp_list_find(pool, size);
+    }
+}
+
+static void _smp_index_insert(smp_pool_t* pool, smp_block_t* block)
+{
+    pool->counters.free_blocks++;
+    
+    switch (pool->engine)
+    {
+        case SMP_ENGINE_SEGREGATED: _smp_bins_insert(pool, pool->control, block); break;
+        case SMP_ENGINE_TLSF: _smp_tlsf_insert(pool, pool->control, block); break;
+        default: _smp_list_insert(pool, block); break;
+    }
+}
+
+static void _smp_index_remove(smp_pool_t* pool, smp_block_t* block)
+{
+    pool->counters.free_blocks--;
+    
+    switch (pool->engine)
+    {
+        case SMP_ENGINE_SEGREGATED: _smp_bins_remove(pool, pool->control, block); break;
+        case SMP_ENGINE_TLSF: _smp_tlsf_remove(pool, pool->control, block); break;
+        default: _smp_list_remove(pool, block); break;
+    }
+}
+
+static smp_block_t* _smp_list_find(smp_pool_t* pool, smp_size_t size)
+{
+    smp_block_t* block = pool->head;
+    smp_block_t* best = NULL;
+    uint32_t candidates = pool->fit_candidates ?: SMP_FIT_GOOD_CANDIDATES;
+    
+    // Next fit resumes from where the last search stopped
+    if (pool->fit == SMP_FIT_NEXT && pool->rover) block = pool->rover;
+    
+    smp_block_t* first = block;
+    
+    while (block)
+    {
+        SMP_PROBE_SCAN(pool);
+        
+        if (block->size >= size)
+        {
+            if (pool->fit == SMP_FIT_NEXT) pool->rover = block;
+            if (pool->fit <= SMP_FIT_NEXT) return block;
+            if (!best || block->size < best->size) best = block;
+            
+            // An exact fit cannot be improved upon
+            if (block->size == size) break;
+            if (pool->fit == SMP_FIT_GOOD && !--candidates) break;
+        }
+        
+        block = _smp_get_linked_block(block, _smp_get_links(block)->next);
+        
+        // Wrap around once to the blocks before the rover
+        if (!block && first != pool->head) block = pool->head;
+        if (block == first) break;
+    }
+    
+    return best;
+}
+
+static void _smp_list_insert(smp_pool_t* pool, smp_block_t* block)
+{
+    pool->head = _smp_list_push(pool->head, block);
+}
+
+static void _smp_list_remove(smp_pool_t* pool, smp_block_t* block)
+{
+    // The rover moves on to the block following the one it points to
+    if (block == pool->rover) pool->rover = _smp_get_linked_block(block, _smp_get_links(block)->next);
+    
+    pool->head = _smp_list_unlink(pool->head, block);
+}
+
+static smp_block_t* _smp_bins_find(smp_pool_t* pool, smp_bins_t* bins, smp_size_t size)
+{
+    // Every block of the bins above the size class of the request fits, so
+    // the request's own bin is only checked at its head
+    uint32_t bin = _smp_fls(size);
+    smp_block_t* block = bins->bitmap & (1u << bin) ? _smp_get_block_at(pool, bins->heads[bin]) : NULL;
+    
+    if (block)
+    {
+        SMP_PROBE_SCAN(pool);
+        
+        if (block->size >= size) return block;
+    }
+    
+    uint32_t candidates = bin + 1 < SMP_BIN_COUNT ? bins->bitmap & (UINT32_MAX << (bin + 1)) : 0;
+    
+    if (candidates) return _smp_get_block_at(pool, bins->heads[__builtin_ctz(candidates)]);
+    
+    // Without any larger block, the rest of the own bin is searched rather
+    // than failing while a block large enough is free
+    while (block)
+    {
+        block = _smp_get_linked_block(block, _smp_get_links(block)->next);
+        
+        if (!block) break;
+        
+        SMP_PROBE_SCAN(pool);
+        
+        if (block->size >= size) return block;
+    }
+    
+    return NULL;
+}
+
+static void _smp_bins_insert(smp_pool_t* pool, smp_bins_t* bins, smp_block_t* block)
+{
+    uint32_t bin = _smp_fls(block->size);
+    
+    bins->heads[bin] = _smp_get_pool_offset(pool, _smp_list_push(_smp_get_block_at(pool, bins->heads[bin]), block));
+    bins->bitmap |= 1u << bin;
+}
+
+static void _smp_bins_remove(smp_pool_t* pool, smp_bins_t* bins, smp_block_t* block)
+{
+    uint32_t bin = _smp_fls(block->size);
+    
+    bins->heads[bin] = _smp_get_pool_offset(pool, _smp_list_unlink(_smp_get_block_at(pool, bins->heads[bin]), block));
+    
+    if (bins->heads[bin] == SMP_NULL_OFFSET) bins->bitmap &= ~(1u << bin);
+}
+
+static SMP_FORCE_INLINE void _smp_tlsf_mapping(smp_size_t size, uint32_t* fl, uint32_t* sl)
+{
+    // Small sizes are spread linearly over the lists of the first level
+    if (size < SMP_TLSF_SMALL_SIZE)
+    {
+        *fl = 0;
+        *sl = size / SMP_GRANULE;
+        return;
+    }
+    
+    uint32_t msb = _smp_fls(size);
+    
+    *sl = (size >> (msb - SMP_TLSF_SL_LOG2)) ^ SMP_TLSF_SL_COUNT;
+    *fl = msb - SMP_TLSF_FL_SHIFT + 1;
+}
+
+static smp_block_t* _smp_tlsf_find(smp_pool_t* pool, smp_tlsf_t* tlsf, smp_size_t size)
+{
+    uint32_t fl;
+    uint32_t sl;
+    
+    _smp_tlsf_mapping(size, &fl, &sl);
+    
+    // Only the head of the request's own list is worth checking
+    if (tlsf->sl_bitmap[fl] & (1u << sl))
+    {
+        smp_block_t* block = _smp_get_block_at(pool, tlsf->heads[fl][sl]);
+        
+        SMP_PROBE_SCAN(pool);
+        
+        if (block->size >= size) return block;
+    }
+    
+    // Round up to the next list so that any block found fits the request
+    if (size >= SMP_TLSF_SMALL_SIZE) size += (1u << (_smp_fls(size) - SMP_TLSF_SL_LOG2)) - 1;
+    
+    _smp_tlsf_mapping(size, &fl, &sl);
+    
+    if (fl >= SMP_TLSF_FL_COUNT) return NULL;
+    
+    uint32_t sl_map = tlsf->sl_bitmap[fl] & (UINT32_MAX << sl);
+    
+    if (!sl_map)
+    {
+        uint32_t fl_map = fl + 1 < SMP_TLSF_FL_COUNT ? tlsf->fl_bitmap & (UINT32_MAX << (fl + 1)) : 0;
+        
+        if (!fl_map) return NULL;
+        
+        fl = __builtin_ctz(fl_map);
+        sl_map = tlsf->sl_bitmap[fl];
+    }
+    
+    return _smp_get_block_at(pool, tlsf->heads[fl][__builtin_ctz(sl_map)]);
+}
+
+static void _smp_tlsf_insert(smp_pool_t* pool, smp_tlsf_t* tlsf, smp_block_t* block)
+{
+    uint32_t fl;
+    uint32_t sl;
+    
+    _smp_tlsf_mapping(block->size, &fl, &sl);
+    tlsf->heads[fl][sl] = _smp_get_pool_offset(pool, _smp_list_push(_smp_get_block_at(pool, tlsf->heads[fl][sl]), block));
+    tlsf->sl_bitmap[fl] |= 1u << sl;
+    tlsf->fl_bitmap |= 1u << fl;
+}
+
+static void _smp_tlsf_remove(smp_pool_t* pool, smp_tlsf_t* tlsf, smp_block_t* block)
+{
+    uint32_t fl;
+    uint32_t sl;
+    
+    _smp_tlsf_mapping(block->size, &fl, &sl);
+    tlsf->heads[fl][sl] = _smp_get_pool_offset(pool, _smp_list_unlink(_smp_get_block_at(pool, tlsf->heads[fl][sl]), block));
+    
+    if (tlsf->heads[fl][sl] != SMP_NULL_OFFSET) return;
+    
+    tlsf->sl_bitmap[fl] &= ~(1u << sl);
+    
+    if (!tlsf->sl_bitmap[fl]) tlsf->fl_bitmap &= ~(1u << fl);
+}
+
+static SMP_FORCE_INLINE bool _smp_test_bit(uint32_t* bits, uint32_t index)
+{
+    return bits[index / 32] & (1u << (index % 32));
+}
+
+// Bits are only written under the pool lock, but buddy split bits are also
+// read without it, so words are stored atomically
+static SMP_FORCE_INLINE void _smp_set_bit(uint32_t* bits, uint32_t index)
+{
+    __atomic_store_n(&bits[index / 32], bits[index / 32] | 1u << (index % 32), __ATOMIC_RELAXED);
+}
+
+static SMP_FORCE_INLINE void _smp_clear_bit(uint32_t* bits, uint32_t index)
+{
+    __atomic_store_n(&bits[index / 32], bits[index / 32] & ~(1u << (index % 32)), __ATOMIC_RELAXED);
+}
+
+static smp_ptr_t _smp_buddy_alloc(smp_pool_t* pool, smp_size_t size)
+{
+    smp_buddy_t* buddy = pool->control;
+    
+    _smp_buddy_prepare(pool, buddy);
+    
+    if (size > pool->size) return NULL;
+    
+    // Find the level of the smallest block holding the request
+    uint32_t level = buddy->levels - 1;
+    
+    while (level && size > (smp_size_t) buddy->min_size << (buddy->levels - 1 - level)) level--;
+    
+    // Take the smallest free block at or above that level
+    uint32_t candidates = buddy->bitmap & (UINT32_MAX >> (31 - level));
+    
+    if (!candidates) return NULL;
+    
+    uint32_t current = _smp_fls(candidates);
+    uint32_t offset = buddy->heads[current];
+    
+    _smp_buddy_unlink(pool, buddy, current, offset);
+    
+    // Every split below leaves one more free block
+    pool->counters.free_blocks += (smp_size_t) level - current - 1;
+    
+    uint32_t node = (1u << current) - 1 + (offset >> (buddy->pool_log2 - current));
+    
+    // Split it down to the requested level, freeing the upper halves
+    while (current < level)
+    {
+        _smp_set_bit(buddy->split, node);
+        current++;
+        node = 2 * node + 1;
+        _smp_buddy_push(pool, buddy, current, offset + (pool->size >> current));
+    }
+    
+    _smp_set_bit(buddy->used, node);
+    _smp_count_used(pool, 1, pool->size >> level);
+    
+    // Free memory is zeroed, except for the links of free blocks
+    memset(pool->memory + offset, 0, sizeof(smp_links_t));
+    
+    return pool->memory + offset;
+}
+
+static void _smp_buddy_dealloc(smp_pool_t* pool, smp_ptr_t ptr)
+{
+    smp_buddy_t* buddy = pool->control;
+    
+    _smp_buddy_prepare(pool, buddy);
+    
+    uint32_t level;
+    uint32_t node = _smp_buddy_find_node(pool, buddy, ptr, &level);
+    
+    if (node == SMP_NULL_OFFSET) return;
+    
+    uint32_t offset = (smp_byte_t*) ptr - pool->memory;
+    
+    _smp_clear_bit(buddy->used, node);
+    _smp_count_used(pool, -1, -(pool->size >> level));
+    pool->counters.free_blocks++;
+    
+    // Merge with the buddy as long as it is free
+    while (level)
+    {
+        uint32_t sibling = node & 1 ? node + 1 : node - 1;
+        
+        if (_smp_test_bit(buddy->split, sibling) || _smp_test_bit(buddy->used, sibling)) break;
+        
+        uint32_t sibling_offset = offset ^ (pool->size >> level);
+        
+        _smp_buddy_unlink(pool, buddy, level, sibling_offset);
+        memset(pool->memory + sibling_offset, 0, sizeof(smp_links_t));
+        pool->counters.free_blocks--;
+        
+        node = (node - 1) / 2;
+        offset &= ~(pool->size >> level);
+        level--;
+        _smp_clear_bit(buddy->split, node);
+    }
+    
+    _smp_buddy_push(pool, buddy, level, offset);
+}
+
+static smp_size_t _smp_buddy_size(smp_pool_t* pool, smp_ptr_t ptr)
+{
+    smp_buddy_t* buddy = pool->control;
+    
+    _smp_buddy_prepare(pool, buddy);
+    
+    uint32_t level;
+    
+    if (_smp_buddy_find_node(pool, buddy, ptr, &level) == SMP_NULL_OFFSET) return 0;
+    
+    return pool->size >> level;
+}
+
+// Gets the size of a block allocated by the caller without taking the lock:
+// the split bits above an allocated block cannot change until it is freed,
+// only other bits of the same words can
+static smp_size_t _smp_buddy_owned_size(smp_pool_t* pool, smp_ptr_t ptr)
+{
+    smp_buddy_t* buddy = pool->control;
+    uint32_t offset = (smp_byte_t*) ptr - pool->memory;
+    uint32_t level = 0;
+    uint32_t node = 0;
+    
+    while (__atomic_load_n(&buddy->split[node / 32], __ATOMIC_RELAXED) & (1u << (node % 32)))
+    {
+        level++;
+        node = 2 * node + 1 + ((offset >> (buddy->pool_log2 - level)) & 1);
+    }
+    
+    // The pointer must be the start of an allocated block
+    if (offset & ((pool->size >> level) - 1)) return 0;
+    if (!(__atomic_load_n(&buddy->used[node / 32], __ATOMIC_RELAXED) & (1u << (node % 32)))) return 0;
+    
+    return pool->size >> level;
+}
+
+static void _smp_buddy_prepare(smp_pool_t* pool, smp_buddy_t* buddy)
+{
+    if (buddy->ready) return;
+    
+    buddy->ready = 1;
+    buddy->pool_log2 = _smp_fls(pool->size);
+    buddy->levels = buddy->pool_log2 - _smp_fls(buddy->min_size) + 1;
+    buddy->bitmap = 0;
+    
+    // The pool starts as a single free block
+    _smp_buddy_push(pool, buddy, 0, 0);
+}
+
+static uint32_t _smp_buddy_find_node(smp_pool_t* pool, smp_buddy_t* buddy, smp_ptr_t ptr, uint32_t* level)
+{
+    uint32_t offset = (smp_byte_t*) ptr - pool->memory;
+    uint32_t node = 0;
+    
+    *level = 0;
+    
+    // Walk down the split nodes towards the block holding the offset
+    while (_smp_test_bit(buddy->split, node))
+    {
+        (*level)++;
+        node = 2 * node + 1 + ((offset >> (buddy->pool_log2 - *level)) & 1);
+    }
+    
+    // The pointer must be the start of an allocated block
+    if (offset & ((pool->size >> *level) - 1)) return SMP_NULL_OFFSET;
+    if (!_smp_test_bit(buddy->used, node)) return SMP_NULL_OFFSET;
+    
+    return node;
+}
+
+static void _smp_buddy_push(smp_pool_t* pool, smp_buddy_t* buddy, uint32_t level, uint32_t offset)
+{
+    smp_links_t* links = (smp_links_t*) (pool->memory + offset);
+    
+    links->prev = 0;
+    links->next = 0;
+    
+    if (buddy->bitmap & (1u << level))
+    {
+        links->next = buddy->heads[level] - offset;
+        ((smp_links_t*) (pool->memory + buddy->heads[level]))->prev = offset - buddy->heads[level];
+    }
+    
+    buddy->heads[level] = offset;
+    buddy->bitmap |= 1u << level;
+}
+
+static void _smp_buddy_unlink(smp_pool_t* pool, smp_buddy_t* buddy, uint32_t level, uint32_t offset)
+{
+    smp_links_t* links = (smp_links_t*) (pool->memory + offset);
+    
+    if (links->prev) ((smp_links_t*) (pool->memory + offset + links->prev))->next = links->next ? links->next - links->prev : 0;
+    if (links->next) ((smp_links_t*) (pool->memory + offset + links->next))->prev = links->prev ? links->prev - links->next : 0;
+    
+    if (offset != buddy->heads[level]) return;
+    
+    if (links->next)
+    {
+        buddy->heads[level] = offset + links->next;
+    }
+    else
+    {
+        buddy->bitmap &= ~(1u << level);
+    }
+}
+
+static smp_ptr_t _smp_slab_alloc(smp_pool_t* pool, smp_size_t size)
+{
+    smp_slab_t* slab = pool->control;
+    uint32_t index;
+    
+    if (size > slab->size) return NULL;
+    
+    if (slab->free)
+    {
+        index = slab->free - 1;
+        
+        smp_byte_t* object = pool->memory + (smp_size_t) index * slab->size;
+        
+        memcpy(&slab->free, object, sizeof(uint32_t));
+        
+        // Free memory is zeroed, except for the links of free objects
+        memset(object, 0, sizeof(uint32_t));
+    }
+    else if (slab->bump < slab->capacity)
+    {
+        index = slab->bump++;
+    }
+    else
+    {
+        return NULL;
+    }
+    
+    _smp_set_bit(slab->used, index);
+    _smp_count_used(pool, 1, slab->size);
+    
+    return pool->memory + (smp_size_t) index * slab->size;
+}
+
+static void _smp_slab_dealloc(smp_pool_t* pool, smp_ptr_t ptr)
+{
+    smp_slab_t* slab = pool->control;
+    uint32_t index = _smp_slab_find_object(pool, slab, ptr);
+    
+    if (index == SMP_NULL_OFFSET) return;
+    
+    _smp_clear_bit(slab->used, index);
+    _smp_count_used(pool, -1, -(smp_size_t) slab->size);
+    
+    memcpy(ptr, &slab->free, sizeof(uint32_t));
+    slab->free = index + 1;
+}
+
+static smp_size_t _smp_slab_size(smp_pool_t* pool, smp_ptr_t ptr)
+{
+    smp_slab_t* slab = pool->control;
+    
+    return _smp_slab_find_object(pool, slab, ptr) != SMP_NULL_OFFSET ? slab->size : 0;
+}
+
+static uint32_t _smp_slab_find_object(smp_pool_t* pool, smp_slab_t* slab, smp_ptr_t ptr)
+{
+    smp_size_t offset = (smp_byte_t*) ptr - pool->memory;
+    
+    // The pointer must be the start of an allocated object
+    if (offset % slab->size) return SMP_NULL_OFFSET;
+    
+    uint32_t index = offset / slab->size;
+    
+    // Lock-free slabs update the bitmap concurrently
+    if (!(__atomic_load_n(&slab->used[index / 32], __ATOMIC_RELAXED) & (1u << (index % 32)))) return SMP_NULL_OFFSET;
+    
+    return index;
+}
+
+static smp_ptr_t _smp_lockfree_alloc(smp_pool_t* pool, smp_size_t size)
+{
+    smp_slab_t* slab = pool->control;
+    
+    if (size > slab->size) return NULL;
+    
+    uint64_t head = __atomic_load_n(&slab->head, __ATOMIC_ACQUIRE);
+    uint32_t index = SMP_NULL_OFFSET;
+    
+    while ((uint32_t) head)
+    {
+        // The object may be taken concurrently, in which case the tag of the
+        // head changed and the stale link is discarded by the failed swap
+        uint32_t link = __atomic_load_n(&slab->links[(uint32_t) head - 1], __ATOMIC_RELAXED);
+        uint64_t next = ((head >> 32) + 1) << 32 | link;
+        
+        if (__atomic_compare_exchange_n(&slab->head, &head, next, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+        {
+            index = (uint32_t) head - 1;
+            break;
+        }
+    }
+    
+    if (index == SMP_NULL_OFFSET)
+    {
+        index = __atomic_load_n(&slab->bump, __ATOMIC_RELAXED);
+        
+        do
+        {
+            if (index >= slab->capacity) return NULL;
+        }
+        while (!__atomic_compare_exchange_n(&slab->bump, &index, index + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    }
+    
+    __atomic_fetch_or(&slab->used[index / 32], 1u << (index % 32), __ATOMIC_RELAXED);
+    
+    return pool->memory + (smp_size_t) index * slab->size;
+}
+
+static void _smp_lockfree_dealloc(smp_pool_t* pool, smp_ptr_t ptr)
+{
+    smp_slab_t* slab = pool->control;
+    smp_size_t offset = (smp_byte_t*) ptr - pool->memory;
+    
+    if (offset % slab->size) return;
+    
+    uint32_t index = offset / slab->size;
+    uint32_t bit = 1u << (index % 32);
+    
+    // Only the thread clearing the used bit may free the object
+    if (!(__atomic_fetch_and(&slab->used[index / 32], ~bit, __ATOMIC_RELAXED) & bit)) return;
+    
+    if (_smp_zeroes_on_free(pool)) smp_zero(ptr, slab->size);
+    
+    uint64_t head = __atomic_load_n(&slab->head, __ATOMIC_RELAXED);
+    uint64_t next;
+    
+    do
+    {
+        __atomic_store_n(&slab->links[index], (uint32_t) head, __ATOMIC_RELAXED);
+        next = ((head >> 32) + 1) << 32 | (index + 1);
+    }
+    while (!__atomic_compare_exchange_n(&slab->head, &head, next, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static smp_size_t _smp_lockfree_used(smp_slab_t* slab)
+{
+    smp_size_t used = 0;
+    
+    for (uint32_t i = 0; i < (slab->capacity + 31) / 32; i++)
+    {
+        used += __builtin_popcount(__atomic_load_n(&slab->used[i], __ATOMIC_RELAXED));
+    }
+    
+    return used;
+}
+
+static smp_ptr_t _smp_arena_alloc(smp_pool_t* pool, smp_size_t alignment, smp_size_t size)
+{
+    smp_arena_t* arena = pool->control;
+    uintptr_t base = (uintptr_t) pool->memory;
+    smp_size_t offset = ((base + arena->used + alignment - 1) & ~(uintptr_t) (alignment - 1)) - base;
+    
+    if (offset > pool->size || size > pool->size - offset) return NULL;
+    
+    arena->used = offset + size;
+    
+    return pool->memory + offset;
+}
+
+static void _smp_zero_scalar(smp_byte_t* ptr, smp_size_t size)
+{
+    memset(ptr, 0, size);
+}
+
+#if defined(SMP_INSTRUMENT) || defined(SMP_TRACE)
+static SMP_FORCE_INLINE uint64_t _smp_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+#endif
+}
+#endif
+
+#ifdef SMP_INSTRUMENT
+static void _smp_probe_record(uint64_t* count, uint64_t* histogram, uint64_t start)
+{
+    uint64_t ticks = _smp_ticks() - start;
+    uint32_t bucket = ticks ? 63 - __builtin_clzll(ticks) : 0;
+    
+    if (bucket >= SMP_HISTOGRAM_BUCKETS) bucket = SMP_HISTOGRAM_BUCKETS - 1;
+    
+    __atomic_fetch_add(count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram[bucket], 1, __ATOMIC_RELAXED);
+}
+#endif
+
+#ifdef SMP_TRACE
+static void _smp_trace_record(smp_pool_t* pool, smp_trace_op_t op, smp_size_t size, smp_ptr_t ptr, uint32_t extra)
+{
+    smp_trace_t* trace = pool->trace;
+    
+    if (!trace) return;
+    
+    uint64_t index = __atomic_fetch_add(&trace->head, 1, __ATOMIC_RELAXED) % trace->capacity;
+    
+    trace->events[index] = (smp_trace_event_t)
+    {
+        .timestamp = _smp_ticks(),
+        .op = op,
+        .size = size < UINT32_MAX ? size : UINT32_MAX,
+        .offset = ptr ? (uint32_t) ((smp_byte_t*) ptr - pool->memory) : SMP_TRACE_NULL,
+        .extra = extra
+    };
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+static void _smp_zero_select(smp_byte_t* ptr, smp_size_t size)
+{
+    void (*kernel)(smp_byte_t*, smp_size_t) = _smp_zero_scalar;
+    
+    __builtin_cpu_init();
+    
+    if (__builtin_cpu_supports("avx2"))
+    {
+        kernel = _smp_zero_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        kernel = _smp_zero_sse2;
+    }
+    
+    __atomic_store_n(&_smp_zero_stream, kernel, __ATOMIC_RELAXED);
+    kernel(ptr, size);
+}
+
+__attribute__((target("sse2")))
+static void _smp_zero_sse2(smp_byte_t* ptr, smp_size_t size)
+{
+    smp_size_t head = -(uintptr_t) ptr & 15;
+    
+    if (head > size) head = size;
+    
+    memset(ptr, 0, head);
+    ptr += head;
+    size -= head;
+    
+    __m128i zero = _mm_setzero_si128();
+    smp_byte_t* end = ptr + (size & ~(smp_size_t) 63);
+    
+    // Non-temporal stores write whole lines without reading them into cache
+    for (; ptr < end; ptr += 64)
+    {
+        _mm_stream_si128((__m128i*) ptr, zero);
+        _mm_stream_si128((__m128i*) (ptr + 16), zero);
+        _mm_stream_si128((__m128i*) (ptr + 32), zero);
+        _mm_stream_si128((__m128i*) (ptr + 48), zero);
+    }
+    
+    // Order the streaming stores before the memory is handed to another thread
+    _mm_sfence();
+    memset(ptr, 0, size & 63);
+}
+
+__attribute__((target("avx2")))
+static void _smp_zero_avx2(smp_byte_t* ptr, smp_size_t size)
+{
+    smp_size_t head = -(uintptr_t) ptr & 31;
+    
+    if (head > size) head = size;
+    
+    memset(ptr, 0, head);
+    ptr += head;
+    size -= head;
+    
+    __m256i zero = _mm256_setzero_si256();
+    smp_byte_t* end = ptr + (size & ~(smp_size_t) 127);
+    
+    for (; ptr < end; ptr += 128)
+    {
+        _mm256_stream_si256((__m256i*) ptr, zero);
+        _mm256_stream_si256((__m256i*) (ptr + 32), zero);
+        _mm256_stream_si256((__m256i*) (ptr + 64), zero);
+        _mm256_stream_si256((__m256i*) (ptr + 96), zero);
+    }
+    
+    _mm_sfence();
+    memset(ptr, 0, size & 127);
+}
+#endif
+
+static void _smp_spinlock_acquire(void* lock)
+{
+    uint32_t* word = lock;
+    
+    // Spin on a plain load so that waiting does not bounce the cache line
+    while (__atomic_exchange_n(word, 1, __ATOMIC_ACQUIRE))
+    {
+        while (__atomic_load_n(word, __ATOMIC_RELAXED)) _smp_cpu_relax();
+    }
+}
+
+static void _smp_spinlock_release(void* lock)
+{
+    __atomic_store_n((uint32_t*) lock, 0, __ATOMIC_RELEASE);
+}
+
+static SMP_FORCE_INLINE void _smp_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ volatile ("yield");
+#endif
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+static void _smp_mutex_acquire(void* lock)
+{
+    pthread_mutex_lock(lock);
+}
+
+static void _smp_mutex_release(void* lock)
+{
+    pthread_mutex_unlock(lock);
+}
+#endif
+
+#if defined(__linux__)
+// The futex word is 0 when unlocked, 1 when locked and 2 when locked with
+// waiters, the lock spinning for a while before sleeping in the kernel
+static void _smp_futex_acquire(void* lock)
+{
+    uint32_t* word = lock;
+    uint32_t state = 0;
+    
+    for (uint32_t i = 0; i < SMP_SPIN_COUNT; i++)
+    {
+        state = 0;
+        
+        if (__atomic_compare_exchange_n(word, &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return;
+        if (state == 2) break;
+        
+        _smp_cpu_relax();
+    }
+    
+    if (state != 2) state = __atomic_exchange_n(word, 2, __ATOMIC_ACQUIRE);
+    
+    while (state)
+    {
+        syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+        state = __atomic_exchange_n(word, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+static void _smp_futex_release(void* lock)
+{
+    uint32_t* word = lock;
+    
+    if (__atomic_exchange_n(word, 0, __ATOMIC_RELEASE) == 2)
+    {
+        syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+#endif
\ No newline at end of file
@@ -30,60 +30,291 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#endif
+
 /**
- * @brief Creates and initializes a static pool and its memory.
+ * @brief Creates and initializes the static memory of a pool.
+ * The whole memory is initially a single free block, preceded by the few
+ * bytes needed for its payload to be aligned to SMP_ALIGNMENT.
  * 
  * @param pool_name The name of the pool.
- * @param pool_size The size of the pool.
+ * @param pool_size The size of the pool, at most SMP_MAX_POOL_SIZE.
  */
-#define SMP_POOL(pool_name, pool_size)                                      \
+#define SMP_POOL_MEMORY(pool_name, pool_size)                               \
+    _Static_assert((pool_size) <= SMP_MAX_POOL_SIZE,                        \
+        "SMP pools with block headers are limited to SMP_MAX_POOL_SIZE");   \
     static union                                                            \
     {                                                                       \
         smp_byte_t raw[pool_size];                                          \
         struct                                                              \
         {                                                                   \
+            smp_byte_t lead[SMP_BLOCK_LEAD];                                \
             smp_block_t block;                                              \
-            smp_byte_t padding[pool_size - sizeof(smp_block_t)];            \
+            smp_byte_t padding[(pool_size) - SMP_BLOCK_LEAD                 \
+                - sizeof(smp_block_t)];                                     \
         };                                                                  \
-    } pool_name##_memory =                                                  \
+    } __attribute__((aligned(SMP_ALIGNMENT))) pool_name##_memory =          \
     {                                                                       \
         .raw = {0},                                                         \
         .block =                                                            \
         {                                                                   \
             .magic = SMP_MAGIC,                                             \
-            .size = pool_size - sizeof(smp_block_t),                        \
+            .size = (pool_size) - SMP_BLOCK_LEAD - sizeof(smp_block_t),     \
             .free = 1,                                                      \
+            .zero = 1,                                                      \
             .offset = 0                                                     \
         }                                                                   \
-    };                                                                      \
+    };
+
+/**
+ * @brief Creates the pool metadata over the memory of the pool.
+ * Extra designated initializers can be given to select the pool engine.
+ * 
+ * @param pool_name The name of the pool.
+ * @param pool_size The size of the pool.
+ */
+#define SMP_POOL_DEFINE(pool_name, pool_size, ...)                          \
     static smp_pool_t pool_name =                                           \
     {                                                                       \
         .memory = pool_name##_memory.raw,                                   \
         .size = pool_size,                                                  \
-        .head = &pool_name##_memory.block                                   \
+        __VA_ARGS__                                                         \
+    };
+
+/**
+ * @brief Creates and initializes a static pool and its memory.
+ * Pool options such as SMP_LOCK_SPIN can follow the size.
+ * 
+ * @param pool_name The name of the pool.
+ * @param pool_size The size of the pool.
+ */
+#define SMP_POOL(pool_name, pool_size, ...)                                 \
+    SMP_POOL_MEMORY(pool_name, pool_size)                                   \
+    SMP_POOL_DEFINE(pool_name, pool_size,                                   \
+        .head = &pool_name##_memory.block,                                  \
+        __VA_ARGS__)
+
+/**
+ * @brief Creates and initializes a static pool whose free blocks are kept in
+ * segregated lists by power-of-two size class.
+ * Deallocation runs in constant time regardless of the number of free
+ * blocks, and so does allocation while a block of a higher size class than
+ * the request is free. Otherwise the blocks of the request's own class are
+ * searched, in time proportional to their number.
+ * 
+ * @param pool_name The name of the pool.
+ * @param pool_size The size of the pool.
+ */
+#define SMP_POOL_SEGREGATED(pool_name, pool_size, ...)                      \
+    SMP_POOL_MEMORY(pool_name, pool_size)                                   \
+    static smp_bins_t pool_name##_bins;                                     \
+    SMP_POOL_DEFINE(pool_name, pool_size,                                   \
+        .head = &pool_name##_memory.block,                                  \
+        .engine = SMP_ENGINE_SEGREGATED,                                    \
+        .control = &pool_name##_bins,                                       \
+        __VA_ARGS__)
+
+/**
+ * @brief Creates and initializes a static pool using the two-level segregated
+ * fit (TLSF) engine.
+ * Free blocks are indexed by a power-of-two first level split linearly into
+ * SMP_TLSF_SL_COUNT second level lists, both levels tracked by bitmaps.
+ * Neither allocation nor deallocation contains a loop: allocation performs
+ * two size mappings, a check of the head of the request's own list, at most
+ * two bitmap searches, one list removal and one list insertion, while
+ * deallocation performs at most two list removals and one list insertion.
+ * Deallocation additionally zeroes the freed payload.
+ * 
+ * @param pool_name The name of the pool.
+ * @param pool_size The size of the pool.
+ */
+#define SMP_POOL_TLSF(pool_name, pool_size, ...)                            \
+    SMP_POOL_MEMORY(pool_name, pool_size)                                   \
+    static smp_tlsf_t pool_name##_tlsf;                                     \
+    SMP_POOL_DEFINE(pool_name, pool_size,                                   \
+        .head = &pool_name##_memory.block,                                  \
+        .engine = SMP_ENGINE_TLSF,                                          \
+        .control = &pool_name##_tlsf,                                       \
+        __VA_ARGS__)
+
+/**
+ * @brief Creates and initializes a static pool using the buddy system.
+ * Blocks are power-of-two multiples of the minimum block size and carry no
+ * header, the state of the block tree being tracked in bitmaps. Splitting
+ * and merging take O(log(pool_size / min_block_size)) steps.
+ * 
+ * @param pool_name The name of the pool.
+ * @param pool_size The size of the pool, a power of two.
+ * @param min_block_size The size of the smallest block, a power of two of at
+ * least 8 bytes.
+ */
+#define SMP_POOL_BUDDY(pool_name, pool_size, min_block_size, ...)           \
+    _Static_assert(!((pool_size) & ((pool_size) - 1)),                      \
+        "SMP buddy pool size must be a power of two");                      \
+    _Static_assert(!((min_block_size) & ((min_block_size) - 1))             \
+        && (min_block_size) >= 8 && (min_block_size) <= (pool_size),        \
+        "SMP buddy minimum block size must be a power of two of at least 8"); \
+    static union                                                            \
+    {                                                                       \
+        smp_byte_t raw[pool_size];                                          \
+    } __attribute__((aligned((min_block_size) > SMP_ALIGNMENT               \
+        ? (min_block_size) : SMP_ALIGNMENT))) pool_name##_memory;           \
+    static uint32_t pool_name##_buddy_bits[2]                               \
+        [SMP_BITMAP_WORDS(2 * ((pool_size) / (min_block_size)))];           \
+    static smp_buddy_t pool_name##_buddy =                                  \
+    {                                                                       \
+        .min_size = min_block_size,                                         \
+        .split = pool_name##_buddy_bits[0],                                 \
+        .used = pool_name##_buddy_bits[1]                                   \
+    };                                                                      \
+    SMP_POOL_DEFINE(pool_name, pool_size,                                   \
+        .engine = SMP_ENGINE_BUDDY,                                         \
+        .control = &pool_name##_buddy,                                      \
+        __VA_ARGS__)
+
+/**
+ * @brief Creates the static memory and state of a slab.
+ * Extra designated initializers can be given for the slab state.
+ * 
+ * @param pool_name The name of the slab.
+ * @param object_size The size of an object, at least 4 bytes.
+ * @param object_count The number of objects.
+ */
+#define SMP_SLAB_MEMORY(pool_name, object_size, object_count, ...)          \
+    _Static_assert((object_size) >= sizeof(uint32_t),                       \
+        "SMP slab objects must be at least 4 bytes");                       \
+    static union                                                            \
+    {                                                                       \
+        smp_byte_t raw[(object_size) * (object_count)];                     \
+    } __attribute__((aligned(SMP_ALIGNMENT))) pool_name##_memory;           \
+    static uint32_t pool_name##_slab_used[SMP_BITMAP_WORDS(object_count)];  \
+    static smp_slab_t pool_name##_slab =                                    \
+    {                                                                       \
+        .size = object_size,                                                \
+        .capacity = object_count,                                           \
+        .used = pool_name##_slab_used,                                      \
+        __VA_ARGS__                                                         \
     };
 
+/**
+ * @brief Creates and initializes a static slab of fixed-size objects.
+ * Objects carry no header: free objects are chained through their first
+ * bytes and allocated objects are tracked in a bitmap, giving constant time
+ * allocation and deallocation. Requests larger than the object size fail.
+ * Objects are aligned to SMP_ALIGNMENT when their size is a multiple of it.
+ * 
+ * @param pool_name The name of the slab.
+ * @param object_size The size of an object, at least 4 bytes.
+ * @param object_count The number of objects.
+ */
+#define SMP_SLAB(pool_name, object_size, object_count, ...)                 \
+    SMP_SLAB_MEMORY(pool_name, object_size, object_count)                   \
+    SMP_POOL_DEFINE(pool_name, (object_size) * (object_count),              \
+        .engine = SMP_ENGINE_SLAB,                                          \
+        .control = &pool_name##_slab,                                       \
+        __VA_ARGS__)
+
+/**
+ * @brief Creates and initializes a static lock-free slab of fixed-size
+ * objects.
+ * The free list head packs the index of the first free object with a tag
+ * incremented by every update, so that a compare-and-swap never succeeds on
+ * a head that was popped and pushed back in between (ABA). The free list is
+ * linked through a separate array so that objects are never read by other
+ * threads. Allocation and deallocation never block and need no lock option.
+ * 
+ * @param pool_name The name of the slab.
+ * @param object_size The size of an object, at least 4 bytes.
+ * @param object_count The number of objects.
+ */
+#define SMP_SLAB_LOCKFREE(pool_name, object_size, object_count, ...)        \
+    SMP_SLAB_MEMORY(pool_name, object_size, object_count,                   \
+        .links = (uint32_t[object_count]) {0})                              \
+    SMP_POOL_DEFINE(pool_name, (object_size) * (object_count),              \
+        .engine = SMP_ENGINE_LOCKFREE,                                      \
+        .control = &pool_name##_slab,                                       \
+        __VA_ARGS__)
+
+/**
+ * @brief Creates and initializes a static arena.
+ * Allocation bumps an offset, aligned to SMP_ALIGNMENT, and allocations carry
+ * no header. Deallocating an allocation does nothing: the whole arena is
+ * given back at once by smp_arena_reset in constant time. Memory is not
+ * zeroed by a reset, smp_calloc clearing only memory used before one.
+ * Allocations do not record their size and cannot be resized.
+ * 
+ * @param pool_name The name of the arena.
+ * @param pool_size The size of the arena.
+ */
+#define SMP_ARENA(pool_name, pool_size, ...)                                \
+    static union                                                            \
+    {                                                                       \
+        smp_byte_t raw[pool_size];                                          \
+    } __attribute__((aligned(SMP_ALIGNMENT))) pool_name##_memory;           \
+    static smp_arena_t pool_name##_arena;                                   \
+    SMP_POOL_DEFINE(pool_name, pool_size,                                   \
+        .engine = SMP_ENGINE_ARENA,                                         \
+        .control = &pool_name##_arena,                                      \
+        __VA_ARGS__)
+
 /**
  * @brief Generates an API for the pool.
- * Generated functions include alloc, calloc and dealloc.
+ * Generated functions include alloc, calloc and dealloc, and may be left
+ * unused.
  * SMP_POOL should be called before.
  * 
  * @param pool_name The name of the pool.
  */
 #define SMP_API(pool_name)                                                  \
-    static void* pool_name##_alloc(size_t size)                             \
+    static __attribute__((unused)) void* pool_name##_alloc(size_t size)     \
     {                                                                       \
         return smp_alloc(&pool_name, size);                                 \
     }                                                                       \
-    static void* pool_name##_calloc(size_t nitems, size_t size)             \
+    static __attribute__((unused)) void* pool_name##_calloc(size_t nitems,  \
+        size_t size)                                                        \
     {                                                                       \
         return smp_calloc(&pool_name, nitems, size);                        \
     }                                                                       \
-    static void pool_name##_dealloc(void* ptr)                              \
+    static __attribute__((unused)) void pool_name##_dealloc(void* ptr)      \
     {                                                                       \
         return smp_dealloc(&pool_name, ptr);                                \
     }
 
+/**
+ * @brief Generates an API for the pool going through a per-thread cache.
+ * Small blocks freed by a thread are kept in its cache and reused without
+ * taking the pool lock, refills and flushes moving batches of blocks from
+ * and to the pool. Generated functions include alloc, calloc, dealloc and
+ * flush, the latter returning the cached blocks of the calling thread to the
+ * pool and being meant to be called before the thread exits. Generated
+ * functions may be left unused.
+ * SMP_POOL should be called before, usually with a lock option.
+ * 
+ * @param pool_name The name of the pool.
+ */
+#define SMP_API_CACHED(pool_name)                                           \
+    static _Thread_local smp_tcache_t pool_name##_tcache;                   \
+    static __attribute__((unused)) void* pool_name##_alloc(size_t size)     \
+    {                                                                       \
+        return smp_tcache_alloc(&pool_name, &pool_name##_tcache, size);     \
+    }                                                                       \
+    static __attribute__((unused)) void* pool_name##_calloc(size_t nitems,  \
+        size_t size)                                                        \
+    {                                                                       \
+        return smp_tcache_calloc(&pool_name, &pool_name##_tcache,           \
+            nitems, size);                                                  \
+    }                                                                       \
+    static __attribute__((unused)) void pool_name##_dealloc(void* ptr)      \
+    {                                                                       \
+        return smp_tcache_dealloc(&pool_name, &pool_name##_tcache, ptr);    \
+    }                                                                       \
+    static __attribute__((unused)) void pool_name##_flush(void)             \
+    {                                                                       \
+        return smp_tcache_flush(&pool_name, &pool_name##_tcache);           \
+    }
+
 /**
  * @brief Creates and initializes a static pool and its memory and generates
  * an API.
@@ -91,34 +322,421 @@
  * @param pool_name The name of the pool.
  * @param pool_size The size of the pool.
  */
-#define SMP_POOL_WITH_API(pool_name, pool_size)                             \
-    SMP_POOL(pool_name, pool_size)                                          \
+#define SMP_POOL_WITH_API(pool_name, pool_size, ...)                        \
+    SMP_POOL(pool_name, pool_size, __VA_ARGS__)                             \
     SMP_API(pool_name)
 
-#define SMP_MAGIC   0xDECAFBAD
+/**
+ * @brief Creates and initializes a static slab of fixed-size objects and
+ * generates an API.
+ * 
+ * @param pool_name The name of the slab.
+ * @param object_size The size of an object, at least 4 bytes.
+ * @param object_count The number of objects.
+ */
+#define SMP_SLAB_WITH_API(pool_name, object_size, object_count, ...)        \
+    SMP_SLAB(pool_name, object_size, object_count, __VA_ARGS__)             \
+    SMP_API(pool_name)
+
+/**
+ * @brief Pool option protecting the pool with a custom lock.
+ * 
+ * @param lock_ops The smp_lock_ops_t of the lock.
+ * @param lock_context The state of the lock passed to its operations.
+ */
+#define SMP_LOCK(lock_ops, lock_context)                                    \
+    .lock = { .ops = lock_ops, .context = lock_context }
+
+// Pool option protecting the pool with a spinlock
+#define SMP_LOCK_SPIN   SMP_LOCK(&smp_spinlock_ops, &(uint32_t) {0})
+
+#if defined(__unix__) || defined(__APPLE__)
+// Pool option protecting the pool with a pthread mutex
+#define SMP_LOCK_MUTEX                                                      \
+    SMP_LOCK(&smp_mutex_ops, &(pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER)
+#endif
+
+#if defined(__linux__)
+// Pool option protecting the pool with a futex-based lock spinning briefly
+// before sleeping
+#define SMP_LOCK_FUTEX  SMP_LOCK(&smp_futex_ops, &(uint32_t) {0})
+#endif
+
+#ifdef SMP_TRACE
+/**
+ * @brief Pool option recording the operations of the pool in a ring buffer.
+ * Only available when SMP_TRACE is defined. The buffer is allocated
+ * statically, the oldest events being overwritten once it is full.
+ * 
+ * @param event_count The number of events kept.
+ */
+#define SMP_TRACE_BUFFER(event_count)                                       \
+    .trace = &(smp_trace_t)                                                 \
+    {                                                                       \
+        .events = (smp_trace_event_t[event_count]) {{0}},                   \
+        .capacity = event_count                                             \
+    }
+#endif
+
+/**
+ * @brief Pool option selecting when the memory of the pool is zeroed.
+ * 
+ * @param policy The smp_zeroing_t of the pool, SMP_ZERO_ON_FREE by default.
+ */
+#define SMP_ZEROING(policy)     .zeroing = policy
+
+/**
+ * @brief Pool option selecting how first-fit pools search their free list.
+ * Other engines index their free blocks and ignore it.
+ * 
+ * @param policy The smp_fit_t of the pool, SMP_FIT_FIRST by default.
+ */
+#define SMP_FIT(policy)         .fit = policy
+
+/**
+ * @brief Pool option setting the number of fitting blocks compared by
+ * SMP_FIT_GOOD before taking the smallest.
+ * 
+ * @param candidates The number of blocks, SMP_FIT_GOOD_CANDIDATES by default.
+ */
+#define SMP_FIT_CANDIDATES(candidates)  .fit_candidates = candidates
+
+#ifndef SMP_FIT_GOOD_CANDIDATES
+#define SMP_FIT_GOOD_CANDIDATES 8
+#endif
+
+#define SMP_MAGIC       0xDECAFBAD
+
+// Alignment of every payload, a power of two of at least 8
+#ifndef SMP_ALIGNMENT
+#define SMP_ALIGNMENT   16
+#endif
+
+#if SMP_ALIGNMENT < 8 || (SMP_ALIGNMENT & (SMP_ALIGNMENT - 1))
+#error "SMP_ALIGNMENT must be a power of two of at least 8"
+#endif
+
+// Largest pool with block headers, whose block sizes are held in 30 bits
+#define SMP_MAX_POOL_SIZE   (1u << 30)
+
+// Bytes before the first block header of a pool aligning its payload
+#define SMP_BLOCK_LEAD  (SMP_ALIGNMENT - sizeof(smp_block_t) % SMP_ALIGNMENT)
+#define SMP_BIN_COUNT   32
+
+#ifndef SMP_TLSF_SL_LOG2
+#define SMP_TLSF_SL_LOG2    4
+#endif
+
+// Second level lists are tracked in 32-bit bitmaps
+#if SMP_TLSF_SL_LOG2 < 1 || SMP_TLSF_SL_LOG2 > 5
+#error "SMP_TLSF_SL_LOG2 must be between 1 and 5"
+#endif
+
+#define SMP_TLSF_SL_COUNT   (1 << SMP_TLSF_SL_LOG2)
+#define SMP_TLSF_FL_SHIFT   (SMP_TLSF_SL_LOG2 + 2) // Block sizes are multiples of 4
+#define SMP_TLSF_FL_COUNT   (32 - SMP_TLSF_FL_SHIFT)
+#define SMP_TLSF_SMALL_SIZE (1 << SMP_TLSF_FL_SHIFT)
+
+#ifndef SMP_TCACHE_GRANULE
+#define SMP_TCACHE_GRANULE  16
+#endif
+
+#ifndef SMP_TCACHE_CLASS_COUNT
+#define SMP_TCACHE_CLASS_COUNT  16
+#endif
+
+#ifndef SMP_TCACHE_DEPTH
+#define SMP_TCACHE_DEPTH    32
+#endif
+
+#ifndef SMP_TCACHE_BATCH
+#define SMP_TCACHE_BATCH    (SMP_TCACHE_DEPTH / 2)
+#endif
+
+#define SMP_TCACHE_MAX_SIZE (SMP_TCACHE_CLASS_COUNT * SMP_TCACHE_GRANULE)
+
+// Size from which memory is zeroed with non-temporal stores
+#ifndef SMP_ZERO_STREAM_THRESHOLD
+#define SMP_ZERO_STREAM_THRESHOLD   (256 * 1024)
+#endif
+
+// Number of buckets of the instrumentation latency histograms
+#ifndef SMP_HISTOGRAM_BUCKETS
+#define SMP_HISTOGRAM_BUCKETS   32
+#endif
+
+#define SMP_TRACE_MAGIC 0x54504D53 // "SMPT"
+#define SMP_TRACE_NULL  UINT32_MAX
+
+#define SMP_BUDDY_LEVEL_COUNT   32
+#define SMP_BITMAP_WORDS(bits)  (((bits) + 31) / 32)
 
 typedef uint8_t smp_byte_t;
 typedef void* smp_ptr_t;
 typedef size_t smp_size_t;
+typedef uint32_t smp_mark_t;
 
 // Structure holding the block metadata
 // This structure is inside the memory pool for every individual block
+// The offset is a boundary tag holding the distance back to the previous block
+// Free blocks hold their free list links at the start of their payload
+// The zero bit is set when the payload is known to be zero, except for the
+// links of a free block
 typedef struct smp_block
 {
     uint32_t magic;
-    uint32_t size : 31;
+    uint32_t size : 30;
     uint32_t free : 1;
+    uint32_t zero : 1;
     uint32_t offset;
 } smp_block_t;
 
+// Allocation engine of a pool
+typedef enum smp_engine
+{
+    SMP_ENGINE_FIRST_FIT = 0,   // Single doubly-linked free list
+    SMP_ENGINE_SEGREGATED,      // Segregated free lists by size class
+    SMP_ENGINE_TLSF,            // Two-level segregated fit
+    SMP_ENGINE_BUDDY,           // Binary buddy system
+    SMP_ENGINE_SLAB,            // Fixed-size objects
+    SMP_ENGINE_LOCKFREE,        // Fixed-size objects without lock
+    SMP_ENGINE_ARENA            // Bump allocation without individual frees
+} smp_engine_t;
+
+// Structure holding the free lists of a segregated pool
+// Bin n holds the free blocks whose size is in [2^n, 2^(n+1))
+typedef struct smp_bins
+{
+    uint32_t ready;
+    uint32_t bitmap; // Bit n is set when bin n is not empty
+    uint32_t heads[SMP_BIN_COUNT]; // Offsets of the first block of each bin
+} smp_bins_t;
+
+// Structure holding the free lists of a TLSF pool
+// The first level is the power-of-two class of the size, the second level
+// splits each class linearly; sizes under SMP_TLSF_SMALL_SIZE use level 0
+typedef struct smp_tlsf
+{
+    uint32_t ready;
+    uint32_t fl_bitmap; // Bit n is set when sl_bitmap[n] is not empty
+    uint32_t sl_bitmap[SMP_TLSF_FL_COUNT]; // Bit m is set when heads[n][m] is not empty
+    uint32_t heads[SMP_TLSF_FL_COUNT][SMP_TLSF_SL_COUNT];
+} smp_tlsf_t;
+
+// Structure holding the block tree of a buddy pool
+// Level 0 is the whole pool, every level halving the block size
+// Nodes are numbered breadth first, the children of node n being 2n+1 and 2n+2
+typedef struct smp_buddy
+{
+    uint32_t ready;
+    uint32_t min_size;
+    uint32_t pool_log2;
+    uint32_t levels;
+    uint32_t bitmap; // Bit n is set when the free list of level n is not empty
+    uint32_t heads[SMP_BUDDY_LEVEL_COUNT]; // Offsets of the first free block of each level
+    uint32_t* split; // Bit n is set when node n is split
+    uint32_t* used; // Bit n is set when node n is allocated
+} smp_buddy_t;
+
+// Structure holding the state of a slab
+// Objects below bump have been handed out at least once, the free ones
+// being chained from free through their first 4 bytes
+// Lock-free slabs use head and links instead, the upper half of head being
+// the ABA tag
+typedef struct smp_slab
+{
+    uint32_t size;
+    uint32_t capacity;
+    uint32_t bump;
+    uint32_t free; // Index + 1 of the first free object, 0 when none
+    uint64_t head; // Tag and index + 1 of the first free object
+    uint32_t* used; // Bit n is set when object n is allocated
+    uint32_t* links; // Index + 1 of the object following object n
+} smp_slab_t;
+
+// Structure holding the state of an arena
+// Memory below used is allocated, memory below dirty may still hold data
+// written before a reset
+typedef struct smp_arena
+{
+    uint32_t used;
+    uint32_t dirty;
+} smp_arena_t;
+
+// Operations of a pool lock
+typedef struct smp_lock_ops
+{
+    void (*acquire)(void* context);
+    void (*release)(void* context);
+} smp_lock_ops_t;
+
+// Structure holding the lock of a thread-safe pool
+typedef struct smp_lock
+{
+    const smp_lock_ops_t* ops; // NULL for pools without locking
+    void* context;
+} smp_lock_t;
+
+// Zeroing policy of a pool
+typedef enum smp_zeroing
+{
+    SMP_ZERO_ON_FREE = 0,   // Freed memory is zeroed, calloc never clears
+    SMP_ZERO_ON_CALLOC,     // Calloc clears memory not known to be zero
+    SMP_ZERO_NEVER          // Memory is never cleared, calloc acting as alloc
+} smp_zeroing_t;
+
+// Structure holding the counters of a pool, updated by every operation
+// The free block count is relative to the single free block of a new pool
+typedef struct smp_counters
+{
+    smp_size_t used_bytes;
+    smp_size_t used_blocks;
+    smp_size_t free_blocks;
+    smp_size_t high_water;
+} smp_counters_t;
+
+#ifdef SMP_INSTRUMENT
+// Structure holding the instrumentation of a pool
+// Bucket n of a histogram counts the calls taking [2^n, 2^(n+1)) ticks, the
+// first bucket also counting calls under a tick and the last one those above
+// Ticks are TSC cycles on x86 and nanoseconds elsewhere
+typedef struct smp_instrument
+{
+    uint64_t allocs;
+    uint64_t deallocs;
+    uint64_t failed_allocs;
+    uint64_t nodes_scanned; // Free blocks examined by allocation searches
+    uint64_t alloc_ticks[SMP_HISTOGRAM_BUCKETS];
+    uint64_t dealloc_ticks[SMP_HISTOGRAM_BUCKETS];
+} smp_instrument_t;
+#endif
+
+// Operation recorded by a trace event
+typedef enum smp_trace_op
+{
+    SMP_TRACE_ALLOC = 0,
+    SMP_TRACE_CALLOC,
+    SMP_TRACE_ALIGNED_ALLOC,    // The extra field holds the alignment
+    SMP_TRACE_REALLOC,          // The extra field holds the offset of the old block
+    SMP_TRACE_DEALLOC,
+    SMP_TRACE_RELEASE           // The offset is the arena mark released to
+} smp_trace_op_t;
+
+// Structure holding an event of an allocation trace
+// Offsets are those of payloads in the memory of the pool, SMP_TRACE_NULL
+// when an allocation failed
+// Timestamps are TSC cycles on x86 and nanoseconds elsewhere
+typedef struct smp_trace_event
+{
+    uint64_t timestamp;
+    uint32_t op;
+    uint32_t size;
+    uint32_t offset;
+    uint32_t extra;
+} smp_trace_event_t;
+
+// Structure heading a trace file, followed by its events from the oldest
+typedef struct smp_trace_header
+{
+    uint32_t magic;
+    uint32_t engine;
+    uint64_t pool_size;
+    uint64_t count;
+    uint64_t dropped; // Events overwritten before the trace was written
+} smp_trace_header_t;
+
+// Structure holding the ring buffer of a trace recorder
+typedef struct smp_trace
+{
+    smp_trace_event_t* events;
+    uint64_t capacity;
+    uint64_t head; // Number of events ever recorded
+} smp_trace_t;
+
+// Structure describing a block visited by a walk of a pool
+typedef struct smp_block_info
+{
+    smp_ptr_t ptr; // Start of the payload
+    smp_size_t size; // Size of the payload
+    uint32_t free;
+} smp_block_info_t;
+
+// Function called for every block of a walk, returning non-zero to stop it
+typedef int (*smp_walk_callback_t)(const smp_block_info_t* block, void* context);
+
+// Structure holding the statistics of a pool
+typedef struct smp_stats
+{
+    smp_size_t used_bytes; // Payload bytes of the allocated blocks
+    smp_size_t free_bytes; // Payload bytes of the free blocks
+    smp_size_t used_blocks;
+    smp_size_t free_blocks;
+    smp_size_t largest_free; // Payload bytes of the largest free block
+    smp_size_t high_water; // Highest used_bytes reached
+    double fragmentation; // 1 - largest_free / free_bytes
+} smp_stats_t;
+
+// Block search policy of first-fit pools
+typedef enum smp_fit
+{
+    SMP_FIT_FIRST = 0,  // First block large enough from the head
+    SMP_FIT_NEXT,       // First block large enough from where the last search stopped
+    SMP_FIT_BEST,       // Smallest block large enough
+    SMP_FIT_GOOD        // Smallest of the first fit_candidates blocks large enough
+} smp_fit_t;
+
 // Structure holding the pool metadata
 typedef struct smp_pool
 {
     smp_byte_t* memory;
     smp_size_t size;
-    smp_block_t* head; // Pointer to the first free block
+    smp_block_t* head; // Pointer to the first free block of first-fit pools
+    smp_block_t* rover; // Free block where the next search starts under SMP_FIT_NEXT
+    smp_fit_t fit;
+    uint32_t fit_candidates; // Blocks compared under SMP_FIT_GOOD, 0 for the default
+    smp_engine_t engine;
+    void* control; // Engine-specific state, NULL for first-fit pools
+    smp_lock_t lock;
+    smp_zeroing_t zeroing;
+    smp_counters_t counters;
+#ifdef SMP_INSTRUMENT
+    smp_instrument_t instrument;
+#endif
+#ifdef SMP_TRACE
+    smp_trace_t* trace; // Recorder of the operations, NULL when not recording
+#endif
 } smp_pool_t;
 
+// Structure holding the position of an iteration over the blocks of a pool
+typedef struct smp_iterator
+{
+    smp_pool_t* pool;
+    smp_size_t offset; // Offset of the next block in the memory of the pool
+} smp_iterator_t;
+
+// Structure holding the blocks cached by a thread for a pool
+// Class n holds blocks of at least (n + 1) * SMP_TCACHE_GRANULE bytes,
+// chained through their first bytes
+typedef struct smp_tcache
+{
+    smp_ptr_t heads[SMP_TCACHE_CLASS_COUNT];
+    uint32_t counts[SMP_TCACHE_CLASS_COUNT];
+} smp_tcache_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern const smp_lock_ops_t smp_spinlock_ops;
+
+#if defined(__unix__) || defined(__APPLE__)
+extern const smp_lock_ops_t smp_mutex_ops;
+#endif
+
+#if defined(__linux__)
+extern const smp_lock_ops_t smp_futex_ops;
+#endif
+
 /**
  * @brief Allocates memory from the pool.
  * 
@@ -128,6 +746,45 @@ typedef struct smp_pool
  */
 smp_ptr_t smp_alloc(smp_pool_t* pool, smp_size_t size);
 
+/**
+ * @brief Allocates several blocks of the same size from the pool at once.
+ * The pool is locked once and, on pools with block headers, the blocks are
+ * carved consecutively out of as few free blocks as possible.
+ * 
+ * @param pool The pool to allocate memory from.
+ * @param size The size of each block.
+ * @param count The number of blocks to allocate.
+ * @param ptrs Array receiving the pointers to the allocated blocks.
+ * @return The number of blocks allocated, stored first in ptrs.
+ */
+smp_size_t smp_alloc_batch(smp_pool_t* pool, smp_size_t size, smp_size_t count, smp_ptr_t* ptrs);
+
+/**
+ * @brief Allocates memory aligned to a power of two from the pool.
+ * The padding needed before the aligned payload is split off as a free
+ * block. The memory is deallocated with smp_dealloc.
+ * 
+ * @param pool The pool to allocate memory from.
+ * @param alignment The alignment of the allocated memory, a power of two.
+ * @param size The size of the allocated memory.
+ * @return Pointer to the allocated memory or NULL on failure.
+ */
+smp_ptr_t smp_aligned_alloc(smp_pool_t* pool, smp_size_t alignment, smp_size_t size);
+
+/**
+ * @brief Resizes allocated memory.
+ * Pools with block headers shrink the memory in place, giving the tail back
+ * as a free block, and grow it in place when the next block is free and
+ * large enough. Otherwise the memory is moved to a new block.
+ * 
+ * @param pool The pool of the allocated memory.
+ * @param ptr Pointer to the memory to resize, or NULL to allocate.
+ * @param size The new size of the memory, or 0 to deallocate.
+ * @return Pointer to the resized memory or NULL on failure, in which case
+ * the memory is left untouched.
+ */
+smp_ptr_t smp_realloc(smp_pool_t* pool, smp_ptr_t ptr, smp_size_t size);
+
 /**
  * @brief Allocates contiguous memory from the pool.
  * 
@@ -146,6 +803,18 @@ smp_ptr_t smp_calloc(smp_pool_t* pool, smp_size_t nitems, smp_size_t size);
  */
 void smp_dealloc(smp_pool_t* pool, smp_ptr_t ptr);
 
+/**
+ * @brief Deallocates several blocks from the pool at once.
+ * The pointers are sorted by address so that runs of physically consecutive
+ * blocks are merged before being coalesced with their free neighbours, all
+ * under a single lock.
+ * 
+ * @param pool The pool to deallocate memory from.
+ * @param ptrs Array of pointers to the memory to deallocate, sorted in place.
+ * @param count The number of pointers.
+ */
+void smp_dealloc_batch(smp_pool_t* pool, smp_ptr_t* ptrs, smp_size_t count);
+
 /**
  * @brief Returns the size of the allocated memory.
  * 
@@ -155,4 +824,214 @@ void smp_dealloc(smp_pool_t* pool, smp_ptr_t ptr);
  */
 smp_size_t smp_size(smp_pool_t* pool, smp_ptr_t ptr);
 
+/**
+ * @brief Visits every block of the pool in address order.
+ * Blocks with a header are found by hopping from header to header using
+ * their sizes, buddy blocks by descending the block tree, slab objects by
+ * stepping through the slab, and an arena is seen as its allocated memory
+ * followed by its free memory. The walk holds the pool lock, so the callback
+ * must not call the functions of the same pool. It stops at the first
+ * corrupted header.
+ * 
+ * @param pool The pool to walk.
+ * @param callback The function called for every block.
+ * @param context The context passed to the callback.
+ * @return The number of blocks visited.
+ */
+smp_size_t smp_walk(smp_pool_t* pool, smp_walk_callback_t callback, void* context);
+
+/**
+ * @brief Starts an iteration over the blocks of the pool in address order.
+ * Unlike smp_walk, the iteration does not hold the pool lock: the pool must
+ * not be modified until the iteration ends.
+ * 
+ * @param iterator The iterator to start.
+ * @param pool The pool to iterate over.
+ */
+void smp_iterator_init(smp_iterator_t* iterator, smp_pool_t* pool);
+
+/**
+ * @brief Advances an iteration to the next block of the pool.
+ * 
+ * @param iterator The iterator to advance.
+ * @param block The next block.
+ * @return 1 when a block was found, 0 at the end of the pool or at the first
+ * corrupted header.
+ */
+int smp_iterator_next(smp_iterator_t* iterator, smp_block_info_t* block);
+
+/**
+ * @brief Gets the statistics of the pool.
+ * Counters are maintained by every operation and read in constant time,
+ * but finding the largest free block, and so the fragmentation, walks the
+ * whole free list of first-fit pools and the highest non-empty size class
+ * of segregated and TLSF pools. The query is therefore O(free blocks) for
+ * these engines, the lock being held during the walk so that every value
+ * describes the same state of the pool; other engines answer in constant
+ * time. Arenas do not count
+ * their allocations. Lock-free slabs keep no shared counters, so that
+ * threads do not contend on them: their usage is counted from their bitmap
+ * of used objects, and their high-water mark is the number of objects ever
+ * handed out without being reused, which is exact without concurrency.
+ * 
+ * @param pool The pool to get the statistics of.
+ * @param stats The statistics of the pool.
+ */
+void smp_stats(smp_pool_t* pool, smp_stats_t* stats);
+
+#ifdef SMP_INSTRUMENT
+/**
+ * @brief Gets the instrumentation of the pool.
+ * Only available when SMP_INSTRUMENT is defined, which must then be the case
+ * for every file including this header. Calls of the allocation functions,
+ * smp_alloc, smp_calloc, smp_alloc_batch, smp_aligned_alloc and
+ * smp_realloc, and of smp_dealloc are counted and timed from before any
+ * zeroing or the pool lock to after it is released. A batch counts as one
+ * call, failed when it allocates fewer blocks than asked.
+ * 
+ * @param pool The pool to get the instrumentation of.
+ * @param instrument The instrumentation of the pool.
+ */
+void smp_instrument(smp_pool_t* pool, smp_instrument_t* instrument);
+
+/**
+ * @brief Clears the instrumentation of the pool.
+ * 
+ * @param pool The pool to clear the instrumentation of.
+ */
+void smp_instrument_reset(smp_pool_t* pool);
+#endif
+
+#ifdef SMP_TRACE
+/**
+ * @brief Writes the events recorded by the pool to a file.
+ * Only available when SMP_TRACE is defined and the pool was created with
+ * SMP_TRACE_BUFFER. Allocations, reallocations, deallocations and arena
+ * releases are recorded as the pool sees them: thread caches are recorded
+ * as they take blocks from the pool and give them back, so blocks held by a
+ * thread cache appear as allocated with the size of their class. The pool
+ * should not be used while its trace is written.
+ * 
+ * @param pool The pool to write the trace of.
+ * @param path The path of the file.
+ * @return 0 on success, -1 when the pool records nothing or the file cannot
+ * be written.
+ */
+int smp_trace_dump(smp_pool_t* pool, const char* path);
+
+/**
+ * @brief Discards the events recorded by the pool.
+ * 
+ * @param pool The pool to discard the events of.
+ */
+void smp_trace_clear(smp_pool_t* pool);
+#endif
+
+/**
+ * @brief Gives back all the memory of an arena at once.
+ * Pointers previously allocated from the arena must no longer be used.
+ * 
+ * @param pool The arena to reset.
+ */
+void smp_arena_reset(smp_pool_t* pool);
+
+/**
+ * @brief Takes a mark of the memory currently allocated from an arena.
+ * 
+ * @param pool The arena to take a mark of.
+ * @return The mark, to be passed to smp_release.
+ */
+smp_mark_t smp_mark(smp_pool_t* pool);
+
+/**
+ * @brief Gives back the memory allocated from an arena since a mark was
+ * taken, in constant time.
+ * Pointers allocated after the mark must no longer be used, and marks taken
+ * after it are invalidated. Releasing a mark above the current allocation
+ * point does nothing.
+ * 
+ * @param pool The arena to release memory to.
+ * @param mark The mark returned by smp_mark.
+ */
+void smp_release(smp_pool_t* pool, smp_mark_t mark);
+
+/**
+ * @brief Zeroes memory the way pools do.
+ * Sizes of at least SMP_ZERO_STREAM_THRESHOLD bytes are zeroed with
+ * non-temporal AVX2 or SSE2 stores, selected at runtime, so that they do
+ * not evict the cache. Other sizes and other architectures use memset.
+ * 
+ * @param ptr Pointer to the memory to zero.
+ * @param size The size of the memory.
+ */
+void smp_zero(smp_ptr_t ptr, smp_size_t size);
+
+/**
+ * @brief Allocates memory through a thread cache.
+ * Requests up to SMP_TCACHE_MAX_SIZE bytes are served from the cache,
+ * which is refilled from the pool with SMP_TCACHE_BATCH blocks when empty.
+ * 
+ * @param pool The pool to allocate memory from.
+ * @param cache The cache of the calling thread.
+ * @param size The size of the allocated memory.
+ * @return Pointer to the allocated memory or NULL on failure.
+ */
+smp_ptr_t smp_tcache_alloc(smp_pool_t* pool, smp_tcache_t* cache, smp_size_t size);
+
+/**
+ * @brief Allocates contiguous memory through a thread cache.
+ * 
+ * @param pool The pool to allocate memory from.
+ * @param cache The cache of the calling thread.
+ * @param nitems The number of contiguous items.
+ * @param size The size of an item.
+ * @return Pointer to the allocated memory or NULL on failure.
+ */
+smp_ptr_t smp_tcache_calloc(smp_pool_t* pool, smp_tcache_t* cache, smp_size_t nitems, smp_size_t size);
+
+/**
+ * @brief Deallocates memory through a thread cache.
+ * Small blocks are kept in the cache, SMP_TCACHE_BATCH of them being
+ * returned to the pool when a class holds SMP_TCACHE_DEPTH blocks.
+ * 
+ * @param pool The pool to deallocate memory from.
+ * @param cache The cache of the calling thread.
+ * @param ptr Pointer to the memory to deallocate.
+ */
+void smp_tcache_dealloc(smp_pool_t* pool, smp_tcache_t* cache, smp_ptr_t ptr);
+
+/**
+ * @brief Returns all the blocks of a thread cache to the pool.
+ * 
+ * @param pool The pool of the cache.
+ * @param cache The cache to flush.
+ */
+void smp_tcache_flush(smp_pool_t* pool, smp_tcache_t* cache);
+
+#ifdef __cplusplus
+}
+
+namespace smp
+{
+    // Scope guard releasing the memory allocated from an arena during its
+    // lifetime when it is destroyed
+    class arena_scope
+    {
+    public:
+        explicit arena_scope(smp_pool_t& pool) : pool_(pool), mark_(smp_mark(&pool)) {}
+        ~arena_scope() { smp_release(&pool_, mark_); }
+        
+        arena_scope(const arena_scope&) = delete;
+        arena_scope& operator=(const arena_scope&) = delete;
+        
+        // Releases the memory allocated since the scope began, keeping the scope open
+        void release() { smp_release(&pool_, mark_); }
+        
+    private:
+        smp_pool_t& pool_;
+        smp_mark_t mark_;
+    };
+}
+#endif
+
 #endif /* SMP_H */
\ No newline at end of file
@@ -0,0 +1,109 @@
+/*
+ * replay.c - Allocation trace replay tool
+ *
+ * Copyright (c) 2024 Laurent Mailloux-Bourassa
+ *
+ * This file is part of the Static Memory Pool (SMP) library.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Re-executes a trace written by smp_trace_dump on pools of every
+ * configuration, or of the one given, with the size of the recorded pool or
+ * the one given. Each configuration is replayed twice on a new pool: once to
+ * time the pool functions, and once taking the statistics of the pool after
+ * every event to find its peak usage and fragmentation. Reports the time per
+ * event and in total, the allocations failing where the recorded ones
+ * succeeded, and the peaks.
+ *
+ * Build: gcc -O2 -Isrc tools/replay.c src/smp.c -o replay
+ * Usage: ./replay trace_file [configuration|all] [pool_size]
+ */
+
+#include "tools.h"
+
+static void replay(const tools_trace_t* trace, const tools_config_t* config, smp_size_t size)
+{
+    smp_pool_t pool;
+    tools_result_t timed;
+    tools_result_t measured;
+
+    if (!tools_pool_create(&pool, config, size))
+    {
+        printf("%-11s cannot create a pool of %zu bytes\n", config->name, size);
+        return;
+    }
+
+    tools_replay(trace, &pool, false, &timed);
+    tools_pool_destroy(&pool);
+
+    tools_pool_create(&pool, config, size);
+    tools_replay(trace, &pool, true, &measured);
+
+    printf("%-11s %12zu %10.1f %12.3f %10llu %12zu %8.1f\n", config->name, pool.size,
+        trace->header.count ? (double) timed.elapsed / trace->header.count : 0.0, timed.elapsed / 1e6,
+        (unsigned long long) timed.failures, measured.peak_used, 100.0 * measured.peak_fragmentation);
+
+    tools_pool_destroy(&pool);
+}
+
+int main(int argc, char** argv)
+{
+    tools_trace_t trace;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s trace_file [configuration|all] [pool_size]\n", argv[0]);
+        return 1;
+    }
+
+    if (!tools_trace_load(&trace, argv[1]))
+    {
+        fprintf(stderr, "%s: cannot read trace %s\n", argv[0], argv[1]);
+        return 1;
+    }
+
+    const char* name = argc > 2 ? argv[2] : "all";
+    smp_size_t size = argc > 3 ? strtoull(argv[3], NULL, 0) : trace.header.pool_size;
+    const tools_config_t* config = tools_find_config(name);
+
+    if (!config && strcmp(name, "all"))
+    {
+        fprintf(stderr, "%s: unknown configuration %s\n", argv[0], name);
+        tools_trace_free(&trace);
+        return 1;
+    }
+
+    printf("%llu events recorded on a pool of %llu bytes", (unsigned long long) trace.header.count,
+        (unsigned long long) trace.header.pool_size);
+
+    if (trace.header.dropped) printf(", %llu older events dropped", (unsigned long long) trace.header.dropped);
+
+    printf("\n%-11s %12s %10s %12s %10s %12s %8s\n", "config", "pool size", "ns/event", "total ms", "failed", "peak used", "frag %");
+
+    for (size_t i = 0; i < TOOLS_CONFIG_COUNT; i++)
+    {
+        if (!config || config == &tools_configs[i]) replay(&trace, &tools_configs[i], size);
+    }
+
+    tools_trace_free(&trace);
+
+    return 0;
+}
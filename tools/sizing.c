@@ -0,0 +1,433 @@
+/*
+ * sizing.c - Pool sizing advisor
+ *
+ * Copyright (c) 2024 Laurent Mailloux-Bourassa
+ *
+ * This file is part of the Static Memory Pool (SMP) library.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Finds how small the pools serving a trace written by smp_trace_dump can be.
+ *
+ * For every configuration, the smallest pool size replaying the trace without
+ * any allocation failing where the recorded one succeeded is searched by
+ * bisection, buddy pools trying powers of two. The usage of that pool at its
+ * peak is split between the requested bytes, the block headers and the bytes
+ * lost to rounding.
+ *
+ * The trace is then split between slabs and a general pool: blocks of up to a
+ * threshold size are served by one slab per power-of-two size class, sized
+ * for the peak count of live blocks of the class, while the other blocks are
+ * replayed on a pool of the recorded configuration (TLSF for header-less
+ * engines) whose smallest size is searched again. Every threshold is tried,
+ * and the declarations of the smallest split are printed.
+ *
+ * Sizes found by bisection assume that a pool failing at some size fails at
+ * every smaller size, which fragmentation can make untrue; the sizes found
+ * are always verified to replay the trace. A trace freeing blocks it never
+ * allocated, because older events were dropped or the blocks were not
+ * recorded, misses part of the usage, which is warned about.
+ *
+ * Build: gcc -O2 -Isrc tools/sizing.c src/smp.c -o sizing
+ * Usage: ./sizing trace_file
+ */
+
+#include "tools.h"
+
+#define MAX_POOL_SIZE (1u << 30)
+#define MIN_CLASS_LOG2 3
+#define MAX_CLASS_LOG2 9
+#define CLASS_COUNT (MAX_CLASS_LOG2 - MIN_CLASS_LOG2 + 1)
+
+typedef struct split
+{
+    uint64_t peaks[CLASS_COUNT]; // Peak live blocks of each slab class
+    smp_size_t slab_bytes;
+    smp_size_t pool_size; // 0 when no block is left to the pool
+} split_t;
+
+// Gets the slab class of a size, CLASS_COUNT when too large for a slab
+static uint32_t size_class(uint32_t size)
+{
+    uint32_t log2 = MIN_CLASS_LOG2;
+
+    while (log2 <= MAX_CLASS_LOG2 && (1u << log2) < size) log2++;
+
+    return log2 - MIN_CLASS_LOG2;
+}
+
+static bool allocates(const smp_trace_event_t* event)
+{
+    return event->op == SMP_TRACE_ALLOC || event->op == SMP_TRACE_CALLOC
+        || event->op == SMP_TRACE_ALIGNED_ALLOC || event->op == SMP_TRACE_REALLOC;
+}
+
+static bool fits(const tools_trace_t* trace, const tools_config_t* config, smp_size_t size)
+{
+    smp_pool_t pool;
+    tools_result_t result;
+
+    if (!tools_pool_create(&pool, config, size)) return false;
+
+    bool replayed = tools_replay(trace, &pool, false, &result);
+
+    tools_pool_destroy(&pool);
+
+    return replayed && !result.failures;
+}
+
+// Finds the smallest pool size replaying the trace, 0 when the trace
+// allocates nothing and SIZE_MAX when no size is found
+static smp_size_t minimal_size(const tools_trace_t* trace, const tools_config_t* config)
+{
+    bool any = false;
+
+    for (uint64_t i = 0; i < trace->header.count && !any; i++)
+    {
+        any = allocates(&trace->events[i]);
+    }
+
+    if (!any) return 0;
+
+    if (config->engine == SMP_ENGINE_BUDDY)
+    {
+        for (smp_size_t size = TOOLS_BUDDY_MIN_SIZE; size <= MAX_POOL_SIZE; size <<= 1)
+        {
+            if (fits(trace, config, size)) return size;
+        }
+
+        return SIZE_MAX;
+    }
+
+    smp_size_t high = tools_pool_size(config, trace->header.pool_size);
+    smp_size_t low = 0;
+
+    while (!fits(trace, config, high))
+    {
+        low = high;
+        high *= 2;
+
+        if (high >= MAX_POOL_SIZE) return SIZE_MAX;
+    }
+
+    while (high - low > SMP_ALIGNMENT)
+    {
+        smp_size_t middle = tools_pool_size(config, low + (high - low) / 2);
+
+        if (middle >= high) break;
+
+        if (fits(trace, config, middle)) high = middle;
+        else low = middle;
+    }
+
+    return high;
+}
+
+// Gets the bytes requested by the blocks live after an event
+static smp_size_t requested_after(const tools_trace_t* trace, uint64_t last)
+{
+    uint32_t* sizes = calloc(trace->header.pool_size / 4 + 1, sizeof(uint32_t));
+    smp_size_t live = 0;
+
+    if (!sizes) return 0;
+
+    for (uint64_t i = 0; i <= last && i < trace->header.count; i++)
+    {
+        const smp_trace_event_t* event = &trace->events[i];
+        bool recorded = event->offset < trace->header.pool_size;
+
+        if (event->op == SMP_TRACE_DEALLOC && recorded)
+        {
+            live -= sizes[event->offset / 4];
+            sizes[event->offset / 4] = 0;
+        }
+        else if (event->op == SMP_TRACE_REALLOC && recorded)
+        {
+            if (event->extra < trace->header.pool_size)
+            {
+                live -= sizes[event->extra / 4];
+                sizes[event->extra / 4] = 0;
+            }
+
+            live += event->size;
+            sizes[event->offset / 4] = event->size;
+        }
+        else if (event->op == SMP_TRACE_RELEASE && recorded)
+        {
+            // Blocks allocated since the mark are given back at once
+            for (uint64_t j = event->offset / 4; j <= trace->header.pool_size / 4; j++)
+            {
+                live -= sizes[j];
+                sizes[j] = 0;
+            }
+        }
+        else if (allocates(event) && recorded)
+        {
+            live += event->size;
+            sizes[event->offset / 4] = event->size;
+        }
+    }
+
+    free(sizes);
+
+    return live;
+}
+
+// Moves the blocks of the slab classes up to a threshold out of the trace,
+// counting their peak, a negative threshold moving none
+// Reallocated blocks leave their slab for the pool
+// Returns false when out of memory
+static bool split_trace(const tools_trace_t* trace, int32_t threshold, tools_trace_t* rest, split_t* split)
+{
+    uint8_t* classes = malloc(trace->header.pool_size / 4 + 1);
+    uint64_t live[CLASS_COUNT] = {0};
+
+    if (!classes) return false;
+
+    memset(split, 0, sizeof(*split));
+    memset(classes, CLASS_COUNT, trace->header.pool_size / 4 + 1);
+    rest->header = trace->header;
+    rest->header.count = 0;
+
+    for (uint64_t i = 0; i < trace->header.count; i++)
+    {
+        smp_trace_event_t event = trace->events[i];
+        bool recorded = event.offset < trace->header.pool_size;
+        uint8_t* class = recorded ? &classes[event.offset / 4] : NULL;
+
+        if (event.op == SMP_TRACE_ALLOC || event.op == SMP_TRACE_CALLOC)
+        {
+            uint32_t block_class = size_class(event.size);
+
+            if (recorded && (int32_t) block_class <= threshold)
+            {
+                *class = block_class;
+
+                if (++live[block_class] > split->peaks[block_class]) split->peaks[block_class] = live[block_class];
+
+                continue;
+            }
+
+            if (recorded) *class = CLASS_COUNT;
+        }
+        else if (event.op == SMP_TRACE_ALIGNED_ALLOC)
+        {
+            if (recorded) *class = CLASS_COUNT;
+        }
+        else if (event.op == SMP_TRACE_DEALLOC)
+        {
+            if (class && *class < CLASS_COUNT)
+            {
+                live[*class]--;
+                *class = CLASS_COUNT;
+                continue;
+            }
+        }
+        else if (event.op == SMP_TRACE_REALLOC)
+        {
+            uint8_t* old_class = event.extra < trace->header.pool_size ? &classes[event.extra / 4] : NULL;
+
+            if (old_class && *old_class < CLASS_COUNT)
+            {
+                // A failed reallocation leaves the block in its slab
+                if (!recorded) continue;
+
+                live[*old_class]--;
+                *old_class = CLASS_COUNT;
+                event.op = SMP_TRACE_ALLOC;
+                event.extra = 0;
+            }
+
+            if (recorded) *class = CLASS_COUNT;
+        }
+
+        rest->events[rest->header.count++] = event;
+    }
+
+    free(classes);
+
+    for (uint32_t c = 0; c < CLASS_COUNT; c++)
+    {
+        split->slab_bytes += (smp_size_t) split->peaks[c] << (c + MIN_CLASS_LOG2);
+    }
+
+    return true;
+}
+
+static const tools_config_t* general_config(const tools_trace_t* trace)
+{
+    for (size_t i = 0; i < TOOLS_CONFIG_COUNT; i++)
+    {
+        if (tools_configs[i].engine == trace->header.engine && trace->header.engine <= SMP_ENGINE_TLSF) return &tools_configs[i];
+    }
+
+    return tools_find_config("tlsf");
+}
+
+static void report_sizes(const tools_trace_t* trace)
+{
+    printf("%-11s %12s %8s %12s %12s %12s %12s\n", "config", "min size", "saved %", "requested", "headers", "rounding", "overhead %");
+
+    for (size_t i = 0; i < TOOLS_CONFIG_COUNT; i++)
+    {
+        const tools_config_t* config = &tools_configs[i];
+
+        // Arenas never reuse memory, so only arena traces are worth replaying on them
+        if (config->engine == SMP_ENGINE_ARENA && trace->header.engine != SMP_ENGINE_ARENA) continue;
+
+        smp_size_t size = minimal_size(trace, config);
+        smp_pool_t pool;
+        tools_result_t result;
+
+        if (!size || size == SIZE_MAX || !tools_pool_create(&pool, config, size))
+        {
+            printf("%-11s %12s\n", config->name, "none");
+            continue;
+        }
+
+        tools_replay(trace, &pool, true, &result);
+        tools_pool_destroy(&pool);
+
+        smp_size_t requested = requested_after(trace, result.peak_event);
+        smp_size_t headers = config->engine <= SMP_ENGINE_TLSF ? result.peak_blocks * sizeof(smp_block_t) : 0;
+        smp_size_t rounding = result.peak_used > requested ? result.peak_used - requested : 0;
+
+        printf("%-11s %12zu %8.1f %12zu %12zu %12zu %12.1f\n", config->name, size,
+            100.0 - 100.0 * size / trace->header.pool_size, requested, headers, rounding,
+            100.0 * (headers + rounding) / size);
+    }
+}
+
+static void report_split(const tools_trace_t* trace)
+{
+    const tools_config_t* config = general_config(trace);
+    tools_trace_t rest = {.events = malloc(trace->header.count * sizeof(smp_trace_event_t) + 1)};
+    split_t best = {0};
+    int32_t best_threshold = -1;
+    smp_size_t best_total = SIZE_MAX;
+
+    if (!rest.events)
+    {
+        fprintf(stderr, "Out of memory, cannot split the trace\n");
+        return;
+    }
+
+    printf("\n%-11s %12s %12s %12s\n", "slabs up to", "slab bytes", "pool size", "total");
+
+    for (int32_t threshold = -1; threshold < CLASS_COUNT; threshold++)
+    {
+        split_t split;
+
+        if (!split_trace(trace, threshold, &rest, &split))
+        {
+            fprintf(stderr, "Out of memory, cannot split the trace\n");
+            free(rest.events);
+            return;
+        }
+
+        split.pool_size = minimal_size(&rest, config);
+
+        if (threshold < 0) printf("%-11s", "none");
+        else printf("%-11u", 1u << (threshold + MIN_CLASS_LOG2));
+
+        if (split.pool_size == SIZE_MAX)
+        {
+            printf(" %12zu %12s\n", split.slab_bytes, "none");
+            continue;
+        }
+
+        smp_size_t total = split.slab_bytes + split.pool_size;
+
+        printf(" %12zu %12zu %12zu\n", split.slab_bytes, split.pool_size, total);
+
+        if (total < best_total)
+        {
+            best = split;
+            best_threshold = threshold;
+            best_total = total;
+        }
+    }
+
+    free(rest.events);
+
+    if (best_total == SIZE_MAX) return;
+
+    printf("\nSmallest split, %zu bytes instead of %llu:\n", best_total, (unsigned long long) trace->header.pool_size);
+
+    for (int32_t c = 0; c <= best_threshold; c++)
+    {
+        uint32_t size = 1u << (c + MIN_CLASS_LOG2);
+
+        if (best.peaks[c]) printf("    SMP_SLAB(slab_%u, %u, %llu)\n", size, size, (unsigned long long) best.peaks[c]);
+    }
+
+    if (!best.pool_size) return;
+
+    const char* fits[] = {"SMP_FIT_FIRST", "SMP_FIT_NEXT", "SMP_FIT_BEST", "SMP_FIT_GOOD"};
+
+    switch (config->engine)
+    {
+        case SMP_ENGINE_SEGREGATED: printf("    SMP_POOL_SEGREGATED(pool, %zu)\n", best.pool_size); break;
+        case SMP_ENGINE_TLSF: printf("    SMP_POOL_TLSF(pool, %zu)\n", best.pool_size); break;
+        default: printf("    SMP_POOL(pool, %zu, SMP_FIT(%s))\n", best.pool_size, fits[config->fit]); break;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    tools_trace_t trace;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s trace_file\n", argv[0]);
+        return 1;
+    }
+
+    if (!tools_trace_load(&trace, argv[1]))
+    {
+        fprintf(stderr, "%s: cannot read trace %s\n", argv[0], argv[1]);
+        return 1;
+    }
+
+    printf("%llu events recorded on a pool of %llu bytes", (unsigned long long) trace.header.count,
+        (unsigned long long) trace.header.pool_size);
+
+    if (trace.header.dropped) printf(", %llu older events dropped", (unsigned long long) trace.header.dropped);
+
+    printf("\n\n");
+
+    uint64_t unmatched = tools_trace_unmatched(&trace);
+
+    // Blocks the trace never allocated are missing from the peak usage
+    if (unmatched)
+    {
+        printf("Warning: %llu deallocations of blocks allocated before the trace or without being recorded,\n"
+            "the sizes below are too small for the recorded workload\n\n", (unsigned long long) unmatched);
+    }
+
+    report_sizes(&trace);
+
+    if (trace.header.engine != SMP_ENGINE_ARENA) report_split(&trace);
+
+    tools_trace_free(&trace);
+
+    return 0;
+}
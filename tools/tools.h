@@ -0,0 +1,415 @@
+/*
+ * tools.h - Static Memory Pool tool helpers
+ *
+ * Copyright (c) 2024 Laurent Mailloux-Bourassa
+ *
+ * This file is part of the Static Memory Pool (SMP) library.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TOOLS_H
+#define TOOLS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "smp.h"
+
+// Buddy pools of the tools split down to this block size
+#define TOOLS_BUDDY_MIN_SIZE 16
+
+/**
+ * @brief Pool configuration a trace can be replayed on.
+ */
+typedef struct tools_config
+{
+    const char* name;
+    smp_engine_t engine;
+    smp_fit_t fit;
+} tools_config_t;
+
+static const tools_config_t tools_configs[] =
+{
+    {"first-fit", SMP_ENGINE_FIRST_FIT, SMP_FIT_FIRST},
+    {"next-fit", SMP_ENGINE_FIRST_FIT, SMP_FIT_NEXT},
+    {"best-fit", SMP_ENGINE_FIRST_FIT, SMP_FIT_BEST},
+    {"good-fit", SMP_ENGINE_FIRST_FIT, SMP_FIT_GOOD},
+    {"segregated", SMP_ENGINE_SEGREGATED, SMP_FIT_FIRST},
+    {"tlsf", SMP_ENGINE_TLSF, SMP_FIT_FIRST},
+    {"buddy", SMP_ENGINE_BUDDY, SMP_FIT_FIRST},
+    {"arena", SMP_ENGINE_ARENA, SMP_FIT_FIRST},
+};
+
+#define TOOLS_CONFIG_COUNT (sizeof(tools_configs) / sizeof(tools_configs[0]))
+
+/**
+ * @brief Allocation trace read from a file written by smp_trace_dump.
+ */
+typedef struct tools_trace
+{
+    smp_trace_header_t header;
+    smp_trace_event_t* events;
+} tools_trace_t;
+
+/**
+ * @brief Outcome of the replay of a trace.
+ */
+typedef struct tools_result
+{
+    uint64_t elapsed; // Nanoseconds spent in the pool functions
+    uint64_t failures; // Allocations failing where the recorded ones succeeded
+    smp_size_t peak_used; // Highest payload bytes allocated at once
+    smp_size_t peak_blocks; // Blocks allocated when the usage peaked
+    uint64_t peak_event; // Index of the event after which the usage peaked
+    double peak_fragmentation; // Highest fragmentation seen after an operation
+} tools_result_t;
+
+/**
+ * @brief Gets the monotonic time in nanoseconds.
+ */
+static inline uint64_t tools_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * @brief Finds a pool configuration by name, returning NULL when unknown.
+ */
+static inline const tools_config_t* tools_find_config(const char* name)
+{
+    for (size_t i = 0; i < TOOLS_CONFIG_COUNT; i++)
+    {
+        if (!strcmp(tools_configs[i].name, name)) return &tools_configs[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Gets the size a pool of a configuration is actually created with:
+ * buddy pools are rounded up to a power of two, others to SMP_ALIGNMENT.
+ */
+static inline smp_size_t tools_pool_size(const tools_config_t* config, smp_size_t size)
+{
+    if (config->engine == SMP_ENGINE_BUDDY)
+    {
+        smp_size_t rounded = TOOLS_BUDDY_MIN_SIZE;
+
+        while (rounded < size) rounded <<= 1;
+
+        return rounded;
+    }
+
+    return (size + SMP_ALIGNMENT - 1) & ~(smp_size_t) (SMP_ALIGNMENT - 1);
+}
+
+/**
+ * @brief Creates a pool of a configuration over heap memory, initialized like
+ * the static pools created by the pool macros.
+ * The size is rounded by tools_pool_size. Returns false when the memory
+ * cannot be allocated.
+ */
+static inline bool tools_pool_create(smp_pool_t* pool, const tools_config_t* config, smp_size_t size)
+{
+    size = tools_pool_size(config, size);
+
+    if (size < SMP_BLOCK_LEAD + sizeof(smp_block_t) + SMP_ALIGNMENT || size > UINT32_MAX) return false;
+
+    if (config->engine <= SMP_ENGINE_TLSF && size > SMP_MAX_POOL_SIZE) return false;
+
+    smp_size_t alignment = config->engine == SMP_ENGINE_BUDDY && TOOLS_BUDDY_MIN_SIZE > SMP_ALIGNMENT ? TOOLS_BUDDY_MIN_SIZE : SMP_ALIGNMENT;
+    smp_byte_t* memory = aligned_alloc(alignment, size);
+
+    memset(pool, 0, sizeof(*pool));
+
+    if (!memory) return false;
+
+    // Pools expect their memory to start zeroed
+    memset(memory, 0, size);
+
+    pool->memory = memory;
+    pool->size = size;
+    pool->engine = config->engine;
+    pool->fit = config->fit;
+
+    switch (config->engine)
+    {
+        case SMP_ENGINE_BUDDY:
+        {
+            smp_buddy_t* buddy = calloc(1, sizeof(smp_buddy_t));
+            smp_size_t words = SMP_BITMAP_WORDS(2 * (size / TOOLS_BUDDY_MIN_SIZE));
+
+            if (!buddy) break;
+
+            buddy->min_size = TOOLS_BUDDY_MIN_SIZE;
+            buddy->split = calloc(2 * words, sizeof(uint32_t));
+            buddy->used = buddy->split + words;
+            pool->control = buddy;
+
+            if (buddy->split) return true;
+            break;
+        }
+        case SMP_ENGINE_ARENA:
+            pool->control = calloc(1, sizeof(smp_arena_t));
+            if (pool->control) return true;
+            break;
+        default:
+        {
+            // The whole memory is initially a single free block
+            smp_block_t* block = (smp_block_t*) (memory + SMP_BLOCK_LEAD);
+
+            *block = (smp_block_t)
+            {
+                .magic = SMP_MAGIC,
+                .size = size - SMP_BLOCK_LEAD - sizeof(smp_block_t),
+                .free = 1,
+                .zero = 1,
+                .offset = 0
+            };
+            pool->head = block;
+
+            if (config->engine == SMP_ENGINE_SEGREGATED) pool->control = calloc(1, sizeof(smp_bins_t));
+            if (config->engine == SMP_ENGINE_TLSF) pool->control = calloc(1, sizeof(smp_tlsf_t));
+            if (pool->control || config->engine == SMP_ENGINE_FIRST_FIT) return true;
+            break;
+        }
+    }
+
+    free(pool->control);
+    free(memory);
+
+    return false;
+}
+
+/**
+ * @brief Frees the memory of a pool created by tools_pool_create.
+ */
+static inline void tools_pool_destroy(smp_pool_t* pool)
+{
+    if (pool->engine == SMP_ENGINE_BUDDY) free(((smp_buddy_t*) pool->control)->split);
+
+    free(pool->control);
+    free(pool->memory);
+}
+
+/**
+ * @brief Reads a trace file, returning false when it cannot be read or is not
+ * a trace.
+ */
+static inline bool tools_trace_load(tools_trace_t* trace, const char* path)
+{
+    FILE* file = fopen(path, "rb");
+
+    trace->events = NULL;
+
+    if (!file) return false;
+
+    bool loaded = fread(&trace->header, sizeof(trace->header), 1, file) == 1
+        && trace->header.magic == SMP_TRACE_MAGIC
+        && trace->header.pool_size <= UINT32_MAX
+        && trace->header.count <= SIZE_MAX / sizeof(smp_trace_event_t) - 1
+        && (trace->events = malloc(trace->header.count * sizeof(smp_trace_event_t) + 1))
+        && fread(trace->events, sizeof(smp_trace_event_t), trace->header.count, file) == trace->header.count;
+
+    fclose(file);
+
+    if (!loaded)
+    {
+        free(trace->events);
+        trace->events = NULL;
+    }
+
+    return loaded;
+}
+
+/**
+ * @brief Frees a trace read by tools_trace_load.
+ */
+static inline void tools_trace_free(tools_trace_t* trace)
+{
+    free(trace->events);
+    trace->events = NULL;
+}
+
+/**
+ * @brief Counts the deallocations and reallocations of blocks the trace
+ * never allocated.
+ * Such blocks were allocated before the oldest event kept, or through a
+ * path the pool did not record; their usage is missing from any replay.
+ */
+static inline uint64_t tools_trace_unmatched(const tools_trace_t* trace)
+{
+    // Payload offsets are at least 4-byte aligned in every engine
+    uint64_t slots = trace->header.pool_size / 4 + 1;
+    uint8_t* live = calloc(slots, 1);
+    uint64_t unmatched = 0;
+
+    if (!live) return 0;
+
+    for (uint64_t i = 0; i < trace->header.count; i++)
+    {
+        const smp_trace_event_t* event = &trace->events[i];
+        bool recorded = event->offset != SMP_TRACE_NULL && event->offset < trace->header.pool_size;
+
+        switch (event->op)
+        {
+            case SMP_TRACE_DEALLOC:
+                if (recorded && !live[event->offset / 4]) unmatched++;
+                if (recorded) live[event->offset / 4] = 0;
+                break;
+            case SMP_TRACE_RELEASE:
+                if (recorded) memset(live + event->offset / 4, 0, slots - event->offset / 4);
+                break;
+            case SMP_TRACE_REALLOC:
+                if (event->extra < trace->header.pool_size && !live[event->extra / 4]) unmatched++;
+
+                // A failed reallocation leaves the old block in place
+                if (!recorded) break;
+                if (event->extra < trace->header.pool_size) live[event->extra / 4] = 0;
+
+                live[event->offset / 4] = 1;
+                break;
+            default:
+                if (recorded) live[event->offset / 4] = 1;
+                break;
+        }
+    }
+
+    free(live);
+
+    return unmatched;
+}
+
+/**
+ * @brief Gives back the blocks allocated since an arena mark was taken.
+ * Pools other than arenas ignore smp_release, so the blocks mapped from
+ * recorded offsets at or above the mark are deallocated one by one.
+ */
+static inline void tools_release(const tools_trace_t* trace, smp_pool_t* pool, smp_ptr_t* blocks, uint32_t mark)
+{
+    if (pool->engine == SMP_ENGINE_ARENA) smp_release(pool, mark);
+
+    for (uint64_t i = mark / 4; i <= trace->header.pool_size / 4; i++)
+    {
+        if (pool->engine != SMP_ENGINE_ARENA) smp_dealloc(pool, blocks[i]);
+
+        blocks[i] = NULL;
+    }
+}
+
+/**
+ * @brief Re-executes a trace on a pool.
+ * Recorded offsets are mapped to the blocks the pool returns, so that the
+ * pool may be of another size or configuration than the recorded one.
+ * Deallocations of blocks allocated before the first event are skipped, and
+ * blocks whose recorded allocation failed are freed at once. Arena releases
+ * free the blocks recorded at or above the mark on other engines. When measured,
+ * the statistics of the pool are taken after every event to track the peak
+ * usage and fragmentation, which makes the replay much slower; its time is
+ * otherwise the time spent in the pool functions.
+ */
+static inline bool tools_replay(const tools_trace_t* trace, smp_pool_t* pool, bool measured, tools_result_t* result)
+{
+    // Payload offsets are at least 4-byte aligned in every engine
+    smp_ptr_t* blocks = calloc(trace->header.pool_size / 4 + 1, sizeof(smp_ptr_t));
+
+    if (!blocks) return false;
+
+    memset(result, 0, sizeof(*result));
+
+    for (uint64_t i = 0; i < trace->header.count; i++)
+    {
+        const smp_trace_event_t* event = &trace->events[i];
+        bool recorded = event->offset != SMP_TRACE_NULL;
+        smp_ptr_t* slot = recorded && event->offset < trace->header.pool_size ? &blocks[event->offset / 4] : NULL;
+        smp_ptr_t* old_slot = event->op == SMP_TRACE_REALLOC && event->extra < trace->header.pool_size ? &blocks[event->extra / 4] : NULL;
+        smp_ptr_t ptr = NULL;
+        uint64_t start = tools_now();
+
+        switch (event->op)
+        {
+            case SMP_TRACE_ALLOC: ptr = smp_alloc(pool, event->size); break;
+            case SMP_TRACE_CALLOC: ptr = smp_calloc(pool, 1, event->size); break;
+            case SMP_TRACE_ALIGNED_ALLOC: ptr = smp_aligned_alloc(pool, event->extra, event->size); break;
+            case SMP_TRACE_REALLOC: ptr = smp_realloc(pool, old_slot ? *old_slot : NULL, event->size); break;
+            case SMP_TRACE_DEALLOC: if (slot) smp_dealloc(pool, *slot); break;
+            case SMP_TRACE_RELEASE: if (recorded) tools_release(trace, pool, blocks, event->offset); break;
+            default: break;
+        }
+
+        result->elapsed += tools_now() - start;
+
+        switch (event->op)
+        {
+            case SMP_TRACE_DEALLOC:
+                if (slot) *slot = NULL;
+                break;
+            case SMP_TRACE_RELEASE:
+                break;
+            case SMP_TRACE_REALLOC:
+                if (!ptr && recorded) result->failures++;
+
+                // A failed reallocation leaves the old block in place
+                if (!ptr && old_slot) ptr = *old_slot;
+                if (old_slot) *old_slot = NULL;
+
+                // The recorded block stayed at its old offset
+                if (!recorded && old_slot)
+                {
+                    *old_slot = ptr;
+                    break;
+                }
+                if (slot) *slot = ptr;
+                break;
+            default:
+                if (!ptr && recorded) result->failures++;
+                if (slot) *slot = ptr;
+                else smp_dealloc(pool, ptr);
+                break;
+        }
+
+        if (measured)
+        {
+            smp_stats_t stats;
+
+            smp_stats(pool, &stats);
+
+            if (stats.used_bytes > result->peak_used)
+            {
+                result->peak_used = stats.used_bytes;
+                result->peak_blocks = stats.used_blocks;
+                result->peak_event = i;
+            }
+
+            if (stats.fragmentation > result->peak_fragmentation) result->peak_fragmentation = stats.fragmentation;
+        }
+    }
+
+    free(blocks);
+
+    return true;
+}
+
+#endif /* TOOLS_H */